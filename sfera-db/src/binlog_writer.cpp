@@ -0,0 +1,80 @@
+
+#include "binlog_writer.hpp"
+
+#include <cassert>
+#include <cstring>
+#include <algorithm>
+
+//----------------------------------------------------------------------------------------------------------------------
+
+namespace sfera_db
+{
+//----------------------------------------------------------------------------------------------------------------------
+
+binlog_writer::binlog_writer(size_t bufferBytes) :
+    _buffer(bufferBytes)
+{
+}
+
+
+void binlog_writer::startFile(raw_file *file)
+{
+    assert( !hasUnwritten() );
+
+    _file = file;
+    _blockSize = std::max(file->blockSize(), (size_t) 512);
+    _bufferedBytes = 0;
+    _writtenBytes = 0;
+    _bufferOffset = 0;
+
+    if (_buffer.size() < 2 * _blockSize) _buffer.resize(2 * _blockSize);
+}
+
+
+void binlog_writer::append(const void *bytes, size_t length)
+{
+    assert( length <= freeBytes() );
+
+    memcpy(_buffer.data() + _bufferedBytes, bytes, length);
+    _bufferedBytes += length;
+}
+
+
+void binlog_writer::reserve(size_t length)
+{
+    if (length <= freeBytes()) return;
+
+    // a record longer than the buffer, the buffer stays that long for the next ones
+    size_t neededBytes = _bufferedBytes + length;
+    _buffer.resize((neededBytes + _blockSize - 1) / _blockSize * _blockSize);
+}
+
+
+auto binlog_writer::pendingWrite() const -> pending_write
+{
+    return pending_write { _file, _buffer.data(), _bufferedBytes, _bufferOffset };
+}
+
+
+void binlog_writer::write(const pending_write &pending)
+{
+    pending.file->writeAll(pending.offset, pending.bytes, pending.length);
+}
+
+
+void binlog_writer::written(const pending_write &pending)
+{
+    assert( pending.bytes == _buffer.data() && pending.offset == _bufferOffset );
+
+    // the whole blocks written are dropped, the last one written in part is written again the next time
+    size_t droppedBytes = pending.length / _blockSize * _blockSize;
+    memmove(_buffer.data(), _buffer.data() + droppedBytes, _bufferedBytes - droppedBytes);
+
+    _bufferedBytes -= droppedBytes;
+    _bufferOffset += droppedBytes;
+    _writtenBytes = pending.length - droppedBytes;
+    _writesCount++;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+}
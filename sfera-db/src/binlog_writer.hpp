@@ -0,0 +1,60 @@
+#ifndef SFERA_DB_BINLOG_WRITER_HPP
+#define SFERA_DB_BINLOG_WRITER_HPP
+
+//----------------------------------------------------------------------------------------------------------------------
+
+#include "raw_file.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+//----------------------------------------------------------------------------------------------------------------------
+
+namespace sfera_db
+{
+
+    // the log records are gathered in a reused buffer and written to the segment at once; the writes start at
+    // the file system block boundaries: the block written in part is kept and written again with the next records
+    class binlog_writer
+    {
+    public:
+        // the buffer part is written without the logger lock, the records appended meanwhile follow it
+        struct pending_write
+        {
+            raw_file *file;
+            const uint8_t *bytes;
+            size_t length;
+            off_t offset;
+        };
+
+    private:
+        raw_file *_file = nullptr;
+        size_t _blockSize = 4096;
+        std::vector<uint8_t> _buffer;    // its capacity is never reduced
+        size_t _bufferedBytes = 0;
+        size_t _writtenBytes = 0;        // the first buffered bytes already in the file (the block written in part)
+        off_t  _bufferOffset = 0;        // of the first buffered byte in the file, a block boundary
+        size_t _writesCount = 0;
+
+    public:
+        explicit binlog_writer(size_t bufferBytes);
+
+        void startFile(raw_file *file);    // the records of the previous file have to be written
+        void append(const void *bytes, size_t length);    // there has to be room for them
+        void reserve(size_t length);       // makes room for so many bytes more, nothing may be being written
+
+        pending_write pendingWrite() const;
+        static void write(const pending_write &pending);
+        void written(const pending_write &pending);
+
+        inline size_t freeBytes() const  { return _buffer.size() - _bufferedBytes; }
+        inline bool hasUnwritten() const  { return _bufferedBytes > _writtenBytes; }
+        inline size_t writesCount() const  { return _writesCount; }
+    };
+
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+#endif //SFERA_DB_BINLOG_WRITER_HPP
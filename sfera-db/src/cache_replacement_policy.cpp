@@ -0,0 +1,492 @@
+
+#include "cache_replacement_policy.hpp"
+
+#include <cassert>
+#include <algorithm>
+
+//----------------------------------------------------------------------------------------------------------------------
+
+namespace sfera_db
+{
+namespace pages_cache_internals
+{
+//----------------------------------------------------------------------------------------------------------------------
+
+cache_replacement_policy* cache_replacement_policy::create(pages_replacement_policy type, size_t sizePages)
+{
+    switch (type) {
+        case pages_replacement_policy::clock:
+            return new clock_replacement_policy(sizePages);
+
+        case pages_replacement_policy::two_queue:
+            return new two_queue_replacement_policy(sizePages);
+
+        case pages_replacement_policy::arc:
+            return new arc_replacement_policy(sizePages);
+
+        case pages_replacement_policy::lru2:
+            return new lru2_replacement_policy(sizePages);
+
+        case pages_replacement_policy::lru:
+        default:
+            return new lru_replacement_policy();
+    }
+}
+
+
+static db_page* oldestUnpinned(const std::list<db_page *> &queue)
+{
+    for (db_page *page : queue) {
+        if (!page->cacheRelatedInfo().isUsed()) return page;
+    }
+    return nullptr;
+}
+
+
+static bool visitQueue(const std::list<db_page *> &queue, const std::function<bool(db_page *)> &visitor)
+{
+    for (db_page *page : queue) {
+        if (!visitor(page)) return false;
+    }
+    return true;
+}
+
+
+static void moveToBack(std::list<db_page *> &queue, db_page *page)
+{
+    queue.erase(page->cacheRelatedInfo().lruQueueIterator);
+    queue.push_back(page);
+    page->cacheRelatedInfo().lruQueueIterator = std::prev(queue.cend());
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+void lru_replacement_policy::onCached(db_page *page)
+{
+    _lruQueue.push_back(page);
+    page->cacheRelatedInfo().lruQueueIterator = std::prev(_lruQueue.cend());
+}
+
+
+size_t lru_replacement_policy::onAccess(db_page *page)
+{
+    moveToBack(_lruQueue, page);
+    return 0;
+}
+
+
+void lru_replacement_policy::onRemoved(db_page *page, bool)
+{
+    _lruQueue.erase(page->cacheRelatedInfo().lruQueueIterator);
+}
+
+
+db_page* lru_replacement_policy::victim()
+{
+    return oldestUnpinned(_lruQueue);
+}
+
+
+void lru_replacement_policy::clear()
+{
+    _lruQueue.clear();
+}
+
+
+void lru_replacement_policy::forEachInEvictionOrder(const std::function<bool(db_page *)> &visitor) const
+{
+    visitQueue(_lruQueue, visitor);
+}
+//----------------------------------------------------------------------------------------------------------------------
+
+clock_replacement_policy::clock_replacement_policy(size_t sizePages)
+{
+    _frames.reserve(sizePages);
+}
+
+
+void clock_replacement_policy::onCached(db_page *page)
+{
+    size_t frame = _frames.size();
+    if (!_freeFrames.empty()) {
+        frame = _freeFrames.back();
+        _freeFrames.pop_back();
+        _frames[frame] = page;
+    } else {
+        _frames.push_back(page);    // the frames array grows while all the pages are pinned or after a cache resize
+    }
+
+    page->cacheRelatedInfo().clockFrame = frame;
+    page->cacheRelatedInfo().referenced = true;
+}
+
+
+size_t clock_replacement_policy::onAccess(db_page *page)
+{
+    page->cacheRelatedInfo().referenced = true;
+    return 0;
+}
+
+
+void clock_replacement_policy::onRemoved(db_page *page, bool)
+{
+    size_t frame = page->cacheRelatedInfo().clockFrame;
+    assert( frame < _frames.size() && _frames[frame] == page );
+
+    _frames[frame] = nullptr;
+    _freeFrames.push_back(frame);
+}
+
+
+db_page* clock_replacement_policy::victim()
+{
+    // two full turns are enough to clear all the reference bits and meet an unpinned page
+    for (size_t step = 0; step < 2 * _frames.size(); ++step) {
+        db_page *page = _frames[_clockHand];
+        _clockHand = (_clockHand + 1) % _frames.size();
+
+        if (page == nullptr || page->cacheRelatedInfo().isUsed()) continue;
+
+        if (page->cacheRelatedInfo().referenced) {
+            page->cacheRelatedInfo().referenced = false;
+            continue;
+        }
+
+        return page;
+    }
+
+    return nullptr;
+}
+
+
+void clock_replacement_policy::clear()
+{
+    _frames.clear();
+    _freeFrames.clear();
+    _clockHand = 0;
+}
+
+
+void clock_replacement_policy::forEachInEvictionOrder(const std::function<bool(db_page *)> &visitor) const
+{
+    for (size_t step = 0; step < _frames.size(); ++step) {
+        db_page *page = _frames[(_clockHand + step) % _frames.size()];
+        if (page != nullptr && !visitor(page)) return;
+    }
+}
+//----------------------------------------------------------------------------------------------------------------------
+
+void ghost_list::push(int pageId, uint64_t value)
+{
+    take(pageId);
+
+    _entries.emplace_back(pageId, value);
+    _positions[pageId] = std::prev(_entries.end());
+}
+
+
+bool ghost_list::take(int pageId, uint64_t *value)
+{
+    auto positionIt = _positions.find(pageId);
+    if (positionIt == _positions.end()) return false;
+
+    if (value != nullptr) *value = positionIt->second->second;
+    _entries.erase(positionIt->second);
+    _positions.erase(positionIt);
+    return true;
+}
+
+
+void ghost_list::popOldest()
+{
+    assert( !_entries.empty() );
+
+    _positions.erase(_entries.front().first);
+    _entries.pop_front();
+}
+
+
+void ghost_list::clear()
+{
+    _entries.clear();
+    _positions.clear();
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+two_queue_replacement_policy::two_queue_replacement_policy(size_t sizePages) :
+    _maxA1inSize(std::max(sizePages / 4, (size_t) 1)),
+    _maxA1outSize(std::max(sizePages / 2, (size_t) 1))
+{ }
+
+
+void two_queue_replacement_policy::onMiss(int pageId)
+{
+    _missedPageRemembered = _a1out.take(pageId);
+}
+
+
+void two_queue_replacement_policy::onCached(db_page *page)
+{
+    auto &queue = _missedPageRemembered ? _am : _a1in;
+    queue.push_back(page);
+
+    page->cacheRelatedInfo().lruQueueIterator = std::prev(queue.cend());
+    page->cacheRelatedInfo().replacementQueue = _missedPageRemembered ? am : a1in;
+    _missedPageRemembered = false;
+}
+
+
+size_t two_queue_replacement_policy::onAccess(db_page *page)
+{
+    // a repeated reference while the page is still in a1in is considered correlated and ignored
+    if (page->cacheRelatedInfo().replacementQueue == am) moveToBack(_am, page);
+    return page->cacheRelatedInfo().replacementQueue;
+}
+
+
+void two_queue_replacement_policy::onRemoved(db_page *page, bool evicted)
+{
+    if (page->cacheRelatedInfo().replacementQueue == am) {
+        _am.erase(page->cacheRelatedInfo().lruQueueIterator);
+        return;
+    }
+
+    _a1in.erase(page->cacheRelatedInfo().lruQueueIterator);
+    if (!evicted) return;
+
+    _a1out.push(page->id());
+    if (_a1out.size() > _maxA1outSize) _a1out.popOldest();
+}
+
+
+db_page* two_queue_replacement_policy::victim()
+{
+    db_page *page = nullptr;
+    if (_a1in.size() > _maxA1inSize) page = oldestUnpinned(_a1in);
+    if (page == nullptr) page = oldestUnpinned(_am);
+    if (page == nullptr) page = oldestUnpinned(_a1in);
+
+    return page;
+}
+
+
+void two_queue_replacement_policy::clear()
+{
+    _a1in.clear();
+    _am.clear();
+    _a1out.clear();
+}
+
+
+void two_queue_replacement_policy::resize(size_t sizePages)
+{
+    _maxA1inSize = std::max(sizePages / 4, (size_t) 1);
+    _maxA1outSize = std::max(sizePages / 2, (size_t) 1);
+
+    while (_a1out.size() > _maxA1outSize) _a1out.popOldest();
+}
+
+
+void two_queue_replacement_policy::forEachInEvictionOrder(const std::function<bool(db_page *)> &visitor) const
+{
+    if (visitQueue(_a1in, visitor)) visitQueue(_am, visitor);
+}
+//----------------------------------------------------------------------------------------------------------------------
+
+arc_replacement_policy::arc_replacement_policy(size_t sizePages) :
+    _sizePages(std::max(sizePages, (size_t) 1))
+{ }
+
+
+void arc_replacement_policy::onMiss(int pageId)
+{
+    _missedPageInB1 = _b1.take(pageId);
+    _missedPageInB2 = !_missedPageInB1 && _b2.take(pageId);
+
+    if (_missedPageInB1) {
+        size_t delta = std::max(_b2.size() / std::max(_b1.size(), (size_t) 1), (size_t) 1);
+        _t1TargetSize = std::min(_t1TargetSize + delta, _sizePages);
+
+    } else if (_missedPageInB2) {
+        size_t delta = std::max(_b1.size() / std::max(_b2.size(), (size_t) 1), (size_t) 1);
+        _t1TargetSize = _t1TargetSize > delta ? _t1TargetSize - delta : 0;
+    }
+}
+
+
+void arc_replacement_policy::onCached(db_page *page)
+{
+    bool frequent = _missedPageInB1 || _missedPageInB2;
+    auto &queue = frequent ? _t2 : _t1;
+    queue.push_back(page);
+
+    page->cacheRelatedInfo().lruQueueIterator = std::prev(queue.cend());
+    page->cacheRelatedInfo().replacementQueue = frequent ? t2 : t1;
+    _missedPageInB1 = _missedPageInB2 = false;
+}
+
+
+size_t arc_replacement_policy::onAccess(db_page *page)
+{
+    auto &info = page->cacheRelatedInfo();
+    size_t queue = info.replacementQueue;
+
+    if (queue == t1) {
+        _t1.erase(info.lruQueueIterator);
+        _t2.push_back(page);
+        info.lruQueueIterator = std::prev(_t2.cend());
+        info.replacementQueue = t2;
+    } else {
+        moveToBack(_t2, page);
+    }
+
+    return queue;
+}
+
+
+void arc_replacement_policy::onRemoved(db_page *page, bool evicted)
+{
+    if (page->cacheRelatedInfo().replacementQueue == t1) {
+        _t1.erase(page->cacheRelatedInfo().lruQueueIterator);
+        if (evicted) _b1.push(page->id());
+    } else {
+        _t2.erase(page->cacheRelatedInfo().lruQueueIterator);
+        if (evicted) _b2.push(page->id());
+    }
+
+    _trimGhosts();
+}
+
+
+void arc_replacement_policy::_trimGhosts()
+{
+    while (_b1.size() > 0 && _t1.size() + _b1.size() > _sizePages) _b1.popOldest();
+    while (_b2.size() > 0 && _t1.size() + _t2.size() + _b1.size() + _b2.size() > 2 * _sizePages) _b2.popOldest();
+}
+
+
+db_page* arc_replacement_policy::victim()
+{
+    bool fromT1 = !_t1.empty() && (_t1.size() > _t1TargetSize || (_missedPageInB2 && _t1.size() == _t1TargetSize));
+
+    db_page *page = oldestUnpinned(fromT1 ? _t1 : _t2);
+    if (page == nullptr) page = oldestUnpinned(fromT1 ? _t2 : _t1);
+
+    return page;
+}
+
+
+void arc_replacement_policy::clear()
+{
+    _t1.clear();
+    _t2.clear();
+    _b1.clear();
+    _b2.clear();
+    _t1TargetSize = 0;
+}
+
+
+void arc_replacement_policy::resize(size_t sizePages)
+{
+    _sizePages = std::max(sizePages, (size_t) 1);
+    _t1TargetSize = std::min(_t1TargetSize, _sizePages);
+
+    _trimGhosts();
+}
+
+
+void arc_replacement_policy::forEachInEvictionOrder(const std::function<bool(db_page *)> &visitor) const
+{
+    bool fromT1 = _t1.size() > _t1TargetSize;
+    if (visitQueue(fromT1 ? _t1 : _t2, visitor)) visitQueue(fromT1 ? _t2 : _t1, visitor);
+}
+//----------------------------------------------------------------------------------------------------------------------
+
+lru2_replacement_policy::lru2_replacement_policy(size_t sizePages) :
+    _sizePages(std::max(sizePages, (size_t) 1))
+{ }
+
+
+auto lru2_replacement_policy::_references(db_page *page) -> references_t
+{
+    return references_t(page->cacheRelatedInfo().penultimateReference, page->cacheRelatedInfo().lastReference);
+}
+
+
+void lru2_replacement_policy::onMiss(int pageId)
+{
+    _missedPageLastReference = 0;
+    _history.take(pageId, &_missedPageLastReference);
+}
+
+
+void lru2_replacement_policy::onCached(db_page *page)
+{
+    auto &info = page->cacheRelatedInfo();
+    info.penultimateReference = _missedPageLastReference;
+    info.lastReference = ++_time;
+    _missedPageLastReference = 0;
+
+    _pages.emplace(_references(page), page);
+}
+
+
+size_t lru2_replacement_policy::onAccess(db_page *page)
+{
+    auto &info = page->cacheRelatedInfo();
+    size_t queue = info.penultimateReference == 0 ? 0 : 1;
+
+    _pages.erase(_references(page));
+    info.penultimateReference = info.lastReference;
+    info.lastReference = ++_time;
+    _pages.emplace(_references(page), page);
+
+    return queue;
+}
+
+
+void lru2_replacement_policy::onRemoved(db_page *page, bool evicted)
+{
+    _pages.erase(_references(page));
+    if (!evicted) return;
+
+    _history.push(page->id(), page->cacheRelatedInfo().lastReference);
+    if (_history.size() > _sizePages) _history.popOldest();
+}
+
+
+db_page* lru2_replacement_policy::victim()
+{
+    // the pages are ordered by the penultimate reference time (0 for the pages referenced once)
+    for (auto &pageEntry : _pages) {
+        if (!pageEntry.second->cacheRelatedInfo().isUsed()) return pageEntry.second;
+    }
+    return nullptr;
+}
+
+
+void lru2_replacement_policy::clear()
+{
+    _pages.clear();
+    _history.clear();
+    _time = 0;
+}
+
+
+void lru2_replacement_policy::resize(size_t sizePages)
+{
+    _sizePages = std::max(sizePages, (size_t) 1);
+    while (_history.size() > _sizePages) _history.popOldest();
+}
+
+
+void lru2_replacement_policy::forEachInEvictionOrder(const std::function<bool(db_page *)> &visitor) const
+{
+    for (auto &pageEntry : _pages) {
+        if (!visitor(pageEntry.second)) return;
+    }
+}
+//----------------------------------------------------------------------------------------------------------------------
+}
+}
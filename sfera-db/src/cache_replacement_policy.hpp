@@ -0,0 +1,215 @@
+#ifndef SFERA_DB_CACHE_REPLACEMENT_POLICY_HPP
+#define SFERA_DB_CACHE_REPLACEMENT_POLICY_HPP
+
+//----------------------------------------------------------------------------------------------------------------------
+
+#include "db_page.hpp"
+#include "db_data_storage_config.hpp"
+
+#include <list>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <functional>
+
+//----------------------------------------------------------------------------------------------------------------------
+
+namespace sfera_db
+{
+    namespace pages_cache_internals
+    {
+
+        // decides which of the cached pages is evicted next (the pages cache owns the pages themselves)
+        class cache_replacement_policy
+        {
+        public:
+            static const size_t maxQueues = 2;
+
+        public:
+            virtual ~cache_replacement_policy() { }
+
+            virtual void onMiss(int)  { }    // called before the eviction the missed page causes
+            virtual void onCached(db_page *page) = 0;
+            virtual size_t onAccess(db_page *page) = 0;    // returns the queue the page has been found in
+            virtual void onRemoved(db_page *page, bool evicted) = 0;    // the freed or resident pages aren't remembered
+            virtual db_page* victim() = 0;    // nullptr if no page can be evicted now
+            virtual void clear() = 0;
+            virtual void resize(size_t)  { }    // the cache evicts the pages over the new size itself
+
+            // visits the pages the most likely to be evicted first until the visitor returns false
+            virtual void forEachInEvictionOrder(const std::function<bool(db_page *)> &visitor) const = 0;
+
+            virtual size_t queuesCount() const  { return 1; }
+            virtual const char* queueName(size_t queue) const = 0;
+
+            static cache_replacement_policy* create(pages_replacement_policy type, size_t sizePages);
+        };
+
+//----------------------------------------------------------------------------------------------------------------------
+
+        class lru_replacement_policy : public cache_replacement_policy
+        {
+        private:
+            std::list<db_page *> _lruQueue;
+
+        public:
+            void onCached(db_page *page) override;
+            size_t onAccess(db_page *page) override;
+            void onRemoved(db_page *page, bool evicted) override;
+            db_page* victim() override;
+            void clear() override;
+            void forEachInEvictionOrder(const std::function<bool(db_page *)> &visitor) const override;
+
+            const char* queueName(size_t) const override  { return "lru"; }
+        };
+
+//----------------------------------------------------------------------------------------------------------------------
+
+        // a hit only sets the reference bit, the clock hand clears them while looking for a victim
+        class clock_replacement_policy : public cache_replacement_policy
+        {
+        private:
+            std::vector<db_page *> _frames;
+            std::vector<size_t> _freeFrames;
+            size_t _clockHand = 0;
+
+        public:
+            clock_replacement_policy(size_t sizePages);
+
+            void onCached(db_page *page) override;
+            size_t onAccess(db_page *page) override;
+            void onRemoved(db_page *page, bool evicted) override;
+            db_page* victim() override;
+            void clear() override;
+            void forEachInEvictionOrder(const std::function<bool(db_page *)> &visitor) const override;
+
+            const char* queueName(size_t) const override  { return "clock"; }
+        };
+
+//----------------------------------------------------------------------------------------------------------------------
+
+        // ids of recently evicted pages in the eviction order with a value remembered for each of them
+        class ghost_list
+        {
+        private:
+            std::list<std::pair<int, uint64_t>> _entries;
+            std::unordered_map<int, std::list<std::pair<int, uint64_t>>::iterator> _positions;
+
+        public:
+            void push(int pageId, uint64_t value = 0);
+            bool take(int pageId, uint64_t *value = nullptr);
+            void popOldest();
+            void clear();
+
+            inline size_t size() const  { return _entries.size(); }
+        };
+
+//----------------------------------------------------------------------------------------------------------------------
+
+        // 2Q: pages referenced once pass through the a1in fifo, only the ones referenced again
+        // after their eviction (remembered in a1out) get into the main lru queue
+        class two_queue_replacement_policy : public cache_replacement_policy
+        {
+        private:
+            enum queue_t { a1in, am };
+
+            size_t _maxA1inSize;
+            size_t _maxA1outSize;
+            std::list<db_page *> _a1in;
+            std::list<db_page *> _am;
+            ghost_list _a1out;
+            bool _missedPageRemembered = false;
+
+        public:
+            two_queue_replacement_policy(size_t sizePages);
+
+            void onMiss(int pageId) override;
+            void onCached(db_page *page) override;
+            size_t onAccess(db_page *page) override;
+            void onRemoved(db_page *page, bool evicted) override;
+            db_page* victim() override;
+            void clear() override;
+            void resize(size_t sizePages) override;
+            void forEachInEvictionOrder(const std::function<bool(db_page *)> &visitor) const override;
+
+            size_t queuesCount() const override  { return 2; }
+            const char* queueName(size_t queue) const override  { return queue == a1in ? "a1in" : "am"; }
+        };
+
+//----------------------------------------------------------------------------------------------------------------------
+
+        // ARC: balances the recency (t1) and frequency (t2) lists adapting the t1 target size
+        // to the hits in the ghost lists of the pages recently evicted from each of them
+        class arc_replacement_policy : public cache_replacement_policy
+        {
+        private:
+            enum queue_t { t1, t2 };
+
+            size_t _sizePages;
+            size_t _t1TargetSize = 0;
+            std::list<db_page *> _t1;
+            std::list<db_page *> _t2;
+            ghost_list _b1;
+            ghost_list _b2;
+            bool _missedPageInB1 = false;
+            bool _missedPageInB2 = false;
+
+        private:
+            void _trimGhosts();
+
+        public:
+            arc_replacement_policy(size_t sizePages);
+
+            void onMiss(int pageId) override;
+            void onCached(db_page *page) override;
+            size_t onAccess(db_page *page) override;
+            void onRemoved(db_page *page, bool evicted) override;
+            db_page* victim() override;
+            void clear() override;
+            void resize(size_t sizePages) override;
+            void forEachInEvictionOrder(const std::function<bool(db_page *)> &visitor) const override;
+
+            size_t queuesCount() const override  { return 2; }
+            const char* queueName(size_t queue) const override  { return queue == t1 ? "t1" : "t2"; }
+        };
+
+//----------------------------------------------------------------------------------------------------------------------
+
+        // LRU-2: evicts the page with the oldest penultimate reference, pages referenced only once go first;
+        // the last reference time of evicted pages is remembered for a while
+        class lru2_replacement_policy : public cache_replacement_policy
+        {
+        private:
+            typedef std::pair<uint64_t, uint64_t> references_t;    // penultimate and last reference times
+
+            size_t _sizePages;
+            uint64_t _time = 0;
+            std::map<references_t, db_page *> _pages;
+            ghost_list _history;
+            uint64_t _missedPageLastReference = 0;
+
+        private:
+            static references_t _references(db_page *page);
+
+        public:
+            lru2_replacement_policy(size_t sizePages);
+
+            void onMiss(int pageId) override;
+            void onCached(db_page *page) override;
+            size_t onAccess(db_page *page) override;
+            void onRemoved(db_page *page, bool evicted) override;
+            db_page* victim() override;
+            void clear() override;
+            void resize(size_t sizePages) override;
+            void forEachInEvictionOrder(const std::function<bool(db_page *)> &visitor) const override;
+
+            size_t queuesCount() const override  { return 2; }
+            const char* queueName(size_t queue) const override  { return queue == 0 ? "referenced once" : "referenced twice"; }
+        };
+
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+#endif //SFERA_DB_CACHE_REPLACEMENT_POLICY_HPP
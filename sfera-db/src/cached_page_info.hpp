@@ -7,19 +7,39 @@
 #include <unordered_map>
 #include <functional>
 #include <list>
+#include <vector>
+#include <atomic>
+#include <cstdint>
 
 //----------------------------------------------------------------------------------------------------------------------
 
 namespace sfera_db
 {
+    class db_page;
+
     namespace pages_cache_internals
     {
 
         struct cached_page_info
         {
-            int pinned = 0;
-            bool dirty = false;
-            std::list<int>::const_iterator lruQueueIterator;
+            std::atomic<int> pinned { 0 };    // changed without the cache shard lock
+            std::atomic<bool> dirty { false };
+            std::atomic<uint64_t> recoveryLsn { 0 };    // the first log record since the last write (0 - none)
+            std::atomic<uint64_t> pageLsn { 0 };        // the last log record of the page, synced before the page is written
+            bool ioInProgress = false;    // the background writer holds the page (changed under the shard lock)
+            bool prefetched = false;      // read ahead of use and not fetched since
+            std::list<db_page *>::const_iterator lruQueueIterator;
+            size_t clockFrame = 0;
+            bool referenced = false;
+            uint8_t replacementQueue = 0;
+            uint64_t lastReference = 0;
+            uint64_t penultimateReference = 0;
+
+            // the cached children by their position in the page, they are not pinned: a child leaving the cache
+            // is unswizzled from its parent; both links are changed under the swizzling latch of the parent
+            std::vector<db_page *> swizzledChildren;
+            std::atomic<db_page *> swizzledParent { nullptr };
+            int swizzledPosition = 0;
 
 
             cached_page_info() { }
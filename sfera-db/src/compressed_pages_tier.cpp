@@ -0,0 +1,105 @@
+
+#include "compressed_pages_tier.hpp"
+#include "lz_page_codec.hpp"
+
+#include <cassert>
+
+//----------------------------------------------------------------------------------------------------------------------
+
+namespace sfera_db
+{
+namespace pages_cache_internals
+{
+//----------------------------------------------------------------------------------------------------------------------
+
+const size_t compressed_pages_tier::maxCompressedPercent;
+const size_t compressed_pages_tier::entryOverheadBytes;
+
+
+compressed_pages_tier::compressed_pages_tier(size_t maxBytes, size_t pageSize) :
+    _pageSize(pageSize),
+    _maxBytes(maxBytes),
+    _compressionBuffer(pageSize * maxCompressedPercent / 100)
+{
+}
+
+
+void compressed_pages_tier::store(int pageId, const uint8_t *pageBytes)
+{
+    invalidate(pageId);
+
+    size_t compressedLength = lz_page_codec::compress(pageBytes, _pageSize, _compressionBuffer.data(),
+                                                      _compressionBuffer.size());
+    if (compressedLength == 0 || compressedLength + entryOverheadBytes > _maxBytes) {
+        _statistics.rejected++;
+        return;
+    }
+
+    _entries.push_back(entry_t { pageId, std::vector<uint8_t>(_compressionBuffer.begin(),
+                                                              _compressionBuffer.begin() + compressedLength) });
+    _entriesById.emplace(pageId, std::prev(_entries.end()));
+    _bytes += compressedLength + entryOverheadBytes;
+    _statistics.storedPages++;
+
+    _trim();
+}
+
+
+bool compressed_pages_tier::take(int pageId, uint8_t *pageBytes)
+{
+    auto entryIt = _entriesById.find(pageId);
+    if (entryIt == _entriesById.end()) return false;
+
+    const std::vector<uint8_t> &compressed = entryIt->second->bytes;
+    bool decompressed = lz_page_codec::decompress(compressed.data(), compressed.size(), pageBytes, _pageSize);
+    assert( decompressed );
+
+    _erase(entryIt->second);
+    if (decompressed) _statistics.hits++;
+    return decompressed;    // the page is read from the disk otherwise
+}
+
+
+void compressed_pages_tier::invalidate(int pageId)
+{
+    auto entryIt = _entriesById.find(pageId);
+    if (entryIt != _entriesById.end()) _erase(entryIt->second);
+}
+
+
+void compressed_pages_tier::clear()
+{
+    _entries.clear();
+    _entriesById.clear();
+    _bytes = 0;
+}
+
+
+void compressed_pages_tier::resize(size_t maxBytes)
+{
+    _maxBytes = maxBytes;
+    _trim();
+}
+
+
+void compressed_pages_tier::_erase(std::list<entry_t>::iterator entryIt)
+{
+    _bytes -= entryIt->bytes.size() + entryOverheadBytes;
+    _entriesById.erase(entryIt->pageId);
+    _entries.erase(entryIt);
+}
+
+
+void compressed_pages_tier::_trim()
+{
+    while (_bytes > _maxBytes) {
+        assert( !_entries.empty() );
+
+        _erase(_entries.begin());
+        _statistics.evictions++;
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+}
+}
@@ -0,0 +1,78 @@
+#ifndef SFERA_DB_COMPRESSED_PAGES_TIER_HPP
+#define SFERA_DB_COMPRESSED_PAGES_TIER_HPP
+
+//----------------------------------------------------------------------------------------------------------------------
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+//----------------------------------------------------------------------------------------------------------------------
+
+namespace sfera_db
+{
+    namespace pages_cache_internals
+    {
+
+        // the second cache level: pages evicted from the frames kept compressed within a byte budget,
+        // the least recently stored are dropped first; a page leaves the tier when it is read back
+        class compressed_pages_tier
+        {
+        public:
+            struct statistics_t
+            {
+                size_t storedPages = 0;
+                size_t hits        = 0;
+                size_t evictions   = 0;
+                size_t rejected    = 0;    // pages compressing worse than maxCompressedPercent
+            };
+
+            static const size_t maxCompressedPercent = 75;
+
+        private:
+            struct entry_t
+            {
+                int pageId;
+                std::vector<uint8_t> bytes;
+            };
+
+            // the list and map nodes of an entry with their links, its bucket and the headers of its three heap blocks
+            static const size_t entryOverheadBytes = sizeof(entry_t) + sizeof(std::pair<const int, void *>) +
+                                                     10 * sizeof(void *);
+
+        private:
+            size_t _pageSize;
+            size_t _maxBytes;
+            size_t _bytes = 0;    // compressed bytes held and the overhead of their entries
+
+            std::list<entry_t> _entries;    // the oldest first
+            std::unordered_map<int, std::list<entry_t>::iterator> _entriesById;
+            std::vector<uint8_t> _compressionBuffer;
+            statistics_t _statistics;
+
+        private:
+            void _erase(std::list<entry_t>::iterator entryIt);
+            void _trim();
+
+        public:
+            compressed_pages_tier(size_t maxBytes, size_t pageSize);
+
+            void store(int pageId, const uint8_t *pageBytes);    // the page is expected to be clean
+            bool take(int pageId, uint8_t *pageBytes);    // decompresses the page and removes it from the tier
+            void invalidate(int pageId);
+            void clear();
+            void resize(size_t maxBytes);
+
+            inline size_t size() const  { return _entries.size(); }
+            inline size_t bytes() const  { return _bytes; }
+            inline const statistics_t &statistics() const  { return _statistics; }
+        };
+
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+#endif //SFERA_DB_COMPRESSED_PAGES_TIER_HPP
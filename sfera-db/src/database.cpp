@@ -16,6 +16,9 @@ namespace sfera_db
 {
 //----------------------------------------------------------------------------------------------------------------------
 
+const size_t database::rebalancesPerRemove;
+
+
 auto database::createEmpty(const std::string &path, database_config const &config) -> database *
 {
     struct stat dirstat = {};
@@ -26,60 +29,243 @@ auto database::createEmpty(const std::string &path, database_config const &confi
     db_data_storage_config dbStorageCfg;
     dbStorageCfg.maxStorageSize = config.maxDBSize;
     dbStorageCfg.pageSize = config.pageSizeBytes;
-    dbStorageCfg.cacheSizeInPages = config.cacheSizePages;
+    dbStorageCfg.cache = _pagesCacheConfig(config);
+    dbStorageCfg.checkpoint = _checkpointConfig(config);
+    dbStorageCfg.binlog = _binlogConfig(config);
 
     database *db = new database();
     db->_dataStorage = db_data_storage::createEmpty(path, dbStorageCfg);
-    db->_maxDataEntryLength = config.maxDataEntryLength;
+    db->_applyRuntimeConfig(config);
 
     db_page *rootPage = db->_dataStorage->allocatePage(true);
     db->_dataStorage->changeRootPage(rootPage->id());
     rootPage->wasSaved(0); // TODO: dirty hack
     db->_dataStorage->releasePage(rootPage);
+    db->_refreshResidentLevels();
 
     return db;
 }
 
 
-auto database::openExisting(const std::string &path) -> database *
+auto database::openExisting(const std::string &path, const database_config &config) -> database *
 {
+    db_data_storage_open_params dbStorageParams;
+    dbStorageParams.cache = _pagesCacheConfig(config);
+    dbStorageParams.cachePreload = config.cachePreload;
+    dbStorageParams.checkpoint = _checkpointConfig(config);
+    dbStorageParams.binlog = _binlogConfig(config);
+    dbStorageParams.recoveryThreads = config.recoveryThreads;
+
     database *db = new database();
-    db->_dataStorage = db_data_storage::openExisting(path);
+    db->_dataStorage = db_data_storage::openExisting(path, dbStorageParams);
     db->_currentOperationId = db->_dataStorage->lastKnownOpId() + 1;
+    db->_applyRuntimeConfig(config);
+
+    for (int pageId : db->_dataStorage->takeDeferredPages()) {
+        db->_deferredRebalances.insert(pageId);
+    }
+    if (db->_keyFilter != nullptr) {
+        db->_rFillKeyFilter(db->_dataStorage->rootPageId());
+    }
+    db->_refreshResidentLevels();
 
     return db;
 }
 
 
+pages_cache_config database::_pagesCacheConfig(const database_config &config)
+{
+    pages_cache_config cacheConfig;
+    cacheConfig.sizePages = config.cacheSizePages;
+    cacheConfig.strictSizeLimit = config.cacheStrictSize;
+    cacheConfig.replacementPolicy = config.cacheReplacementPolicy;
+    cacheConfig.hugePages = config.cacheHugePages;
+    cacheConfig.shardsCount = config.cacheShards;
+    cacheConfig.writerPagesPerSecond = config.backgroundWriterPagesPerSecond;
+    cacheConfig.writerCleanPercent = config.backgroundWriterCleanPercent;
+    cacheConfig.prefetchThreads = config.prefetchThreads;
+    cacheConfig.swizzling = config.swizzleChildPointers;
+    cacheConfig.compressedTierBytes = config.cacheCompressedBytes;
+    cacheConfig.flushThreads = config.flushThreads;
+
+    return cacheConfig;
+}
+
+
+checkpoint_config database::_checkpointConfig(const database_config &config)
+{
+    checkpoint_config checkpointConfig;
+    checkpointConfig.intervalSeconds = config.checkpointIntervalSeconds;
+    checkpointConfig.logBytes = config.checkpointLogBytes;
+
+    return checkpointConfig;
+}
+
+
+binlog_config database::_binlogConfig(const database_config &config)
+{
+    binlog_config binlogConfig;
+    binlogConfig.segmentBytes = config.logSegmentBytes;
+    binlogConfig.pageChanges = config.logPageChanges;
+    binlogConfig.durability = config.logDurability;
+    binlogConfig.syncIntervalMs = config.logSyncIntervalMs;
+    binlogConfig.bufferBytes = config.logBufferBytes;
+
+    return binlogConfig;
+}
+
+
+void database::_applyRuntimeConfig(const database_config &config)
+{
+    _maxDataEntryLength = config.maxDataEntryLength;
+    _deferredRebalancing = config.deferredRebalancing;
+    _maxDeferredRebalances = config.maxDeferredRebalances;
+    _residentTreeLevels = config.residentTreeLevels;
+
+    if (config.hashIndexEntries > 0) {
+        _hashIndex = new db_hash_index(config.hashIndexEntries, config.hashIndexAdmissionLookups);
+    }
+    if (config.keyFilterSizeBytes > 0) {
+        _keyFilter = new db_key_filter(config.keyFilterSizeBytes, config.keyFilterHashes);
+    }
+    if (config.recordCacheSizeBytes > 0) {
+        _recordCache = new db_record_cache(config.recordCacheSizeBytes, config.maxDataEntryLength);
+    }
+}
+
+
+void database::_rFillKeyFilter(int pageId)
+{
+    db_page *page = _dataStorage->fetchPage(pageId);
+    _prefetchChildren(page);
+    std::vector<int> children;
+
+    for (auto elementIt = page->keysBegin(); elementIt != page->keysEnd(); ++elementIt) {
+        _keyFilter->add(*elementIt);
+        if (page->hasChildren()) children.push_back(elementIt.child());
+    }
+    if (page->hasChildren()) children.push_back(page->lastRightChild());
+
+    _dataStorage->releasePage(page);
+
+    for (int childId : children) {
+        _rFillKeyFilter(childId);
+    }
+}
+
+
+void database::_prefetchChildren(db_page *page) const
+{
+    if (!page->hasChildren()) return;
+
+    std::vector<int> children;
+    for (int i = 0; i <= page->recordCount(); ++i) {
+        children.push_back(page->childAt(i));
+    }
+
+    _dataStorage->prefetchPages(children);
+}
+
+
 void database::insert(data_blob key, data_blob value)
 {
+    std::unique_lock<std::mutex> lock(_operationsMutex);
+    if (_recordCache != nullptr) _recordCache->invalidate(key);
+
     db_operation operation(_currentOperationId++);
     _dataStorage->onOperationStart(&operation);
 
     _rKeyInsertionLookup(_dataStorage->rootPageId(), -1, 0, key_value(key, value));
 
     _dataStorage->onOperationEnd();
+    if (_residentLevelsStale) _refreshResidentLevels();
+
+    _waitCommitted(lock);
+}
+
+
+void database::_waitCommitted(std::unique_lock<std::mutex> &lock)
+{
+    uint64_t lsn = _dataStorage->lastLoggedLsn();
+    lock.unlock();
+
+    _dataStorage->waitCommitted(lsn);
 }
 
 
 database::~database()
 {
+    // rebalancing them all could take as long as the deletes have saved, so they are left for the next session
+    _dataStorage->setDeferredPages(std::vector<int>(_deferredRebalances.begin(), _deferredRebalances.end()));
+
     delete _dataStorage;
+    delete _hashIndex;
+    delete _keyFilter;
+    delete _recordCache;
 }
 
 
 data_blob_copy database::get(data_blob key)
 {
+    std::lock_guard<std::mutex> lock(_operationsMutex);
+
+    if (_keyFilter != nullptr && !_keyFilter->mayContain(key)) {
+        _keyFilter->onFilteredLookup();
+        return data_blob_copy();
+    }
+
+    if (_recordCache != nullptr) {
+        data_blob_copy cachedValue = _recordCache->find(key);
+        if (cachedValue.valid()) return cachedValue;
+    }
+
     db_operation operation(_currentOperationId++);
     _dataStorage->onOperationStart(&operation);
 
-    auto result = _lookupByKey(key);
+    data_blob_copy result;
+    if (_hashIndex == nullptr || !_lookupByHashIndex(key, result)) {
+        result = _lookupByKey(key);
+    }
 
     _dataStorage->onOperationEnd();
+
+    if (_recordCache != nullptr && result.valid()) {
+        _recordCache->admit(key, result);
+    }
+
+    if (_keyFilter != nullptr && !result.valid()) {
+        _keyFilter->onFalsePositive();
+    }
     return result;
 }
 
 
+bool database::_lookupByHashIndex(data_blob key, data_blob_copy &result)
+{
+    auto entry = _hashIndex->find(key);
+    if (entry == nullptr) return false;
+
+    // the entry is trusted only if the page is still cached and has not been changed since
+    db_page *page = _dataStorage->fetchCachedPage(entry->pageId);
+    if (page != nullptr) {
+        bool valid = page->lastModifiedOpId() == entry->pageVersion &&
+                     entry->inPagePosition < page->recordCount() &&
+                     _keysEqual(key, page->keyAt(entry->inPagePosition));
+
+        if (valid) result = data_blob_copy(page->valueAt(entry->inPagePosition));
+        _dataStorage->releasePage(page);
+
+        if (valid) {
+            _hashIndex->onHit();
+            return true;
+        }
+    }
+
+    _hashIndex->onStaleEntry();
+    return false;
+}
+
+
 bool database::_binaryKeyComparer(data_blob key1, data_blob key2)
 {
     int cr = memcmp(key1.dataPtr(), key2.dataPtr(), std::min(key1.length(), key2.length()));
@@ -123,6 +309,7 @@ void database::_rKeyInsertionLookup(int pageId, int parentPageId, int parentReco
     if (!page->hasChildren()) {
         page->insert(keyIt, element);
         _dataStorage->writeAndRelease(page);
+        if (_keyFilter != nullptr) _keyFilter->add(element.key);
         return;
     }
 
@@ -140,6 +327,8 @@ bool database::_rKeyErasingLookup(int pageId, int parentPageId, int parentRecord
     auto keyIt = std::lower_bound(page->keysBegin(), page->keysEnd(), elementKey, _binaryKeyComparer);
 
     if (keyIt != page->keysEnd() && _keysEqual(elementKey, *keyIt)) {
+        if (_keyFilter != nullptr) _keyFilter->remove(elementKey);
+
         if (!page->hasChildren()) {
             return _removeFromLeaf(page, keyIt.position(), parentPageId, parentRecordPos);
         } else {
@@ -148,6 +337,7 @@ bool database::_rKeyErasingLookup(int pageId, int parentPageId, int parentRecord
     }
 
     if (!page->hasChildren()) {
+        _dataStorage->releasePage(page);
         return false;
         //throw std::runtime_error("Deleting not existing element");
     }
@@ -170,7 +360,7 @@ void database::_makeNewRoot(key_value element, int leftLink, int rightLink)
     newRootPage->insert(0, element, leftLink);
     newRootPage->reconnect(1, rightLink);
 
-    _dataStorage->changeRootPage(newRootPage->id());
+    _changeRootPage(newRootPage->id());
     _dataStorage->writePage(newRootPage);
     _dataStorage->releasePage(newRootPage);
 }
@@ -178,6 +368,7 @@ void database::_makeNewRoot(key_value element, int leftLink, int rightLink)
 
 db_page *database::_splitPage(db_page *page, db_page *parentPage, int parentRecordPos, const key_value &element)
 {
+    if (_dataStorage->pagesCache().isResident(page->id())) _residentLevelsStale = true;    // the level grows
     db_page *rightPage = _dataStorage->allocatePage(!page->hasChildren());
     key_value_copy medianElement = page->splitEquispace(rightPage);
     db_page *leftPage = page;
@@ -220,12 +411,11 @@ bool database::_makePageMinimallyFilled(db_page *page, int parentPageId, int par
     bool ret = false;
     bool rotationSucceeded = _tryTakeFromNearest(page, parentPage, parentRecordPos, leftPrevPage, rightNextPage);
     if (!rotationSucceeded) {    // so merge the nodes
-        _mergePages(page, parentRecordPos, parentPage, rightNextPage, leftPrevPage);
-        ret = true;
+        ret = _mergePages(page, parentRecordPos, parentPage, rightNextPage, leftPrevPage);
     }
 
-    _dataStorage->writePage(parentPage);
-    _dataStorage->writePage(page);
+    if (parentPage->wasChanged()) _dataStorage->writePage(parentPage);
+    if (page->wasChanged()) _dataStorage->writePage(page);
 
     _dataStorage->releasePage(parentPage);
     if (leftPrevPage != nullptr) _dataStorage->releasePage(leftPrevPage);
@@ -235,7 +425,7 @@ bool database::_makePageMinimallyFilled(db_page *page, int parentPageId, int par
 }
 
 
-void database::_mergePages(db_page *page, int parentRecordPos, db_page *parentPage, db_page *rightNextPage,
+bool database::_mergePages(db_page *page, int parentRecordPos, db_page *parentPage, db_page *rightNextPage,
                            db_page *leftPrevPage)
 {
     assert(page != rightNextPage && page != leftPrevPage);   // avoid self merging
@@ -254,7 +444,7 @@ void database::_mergePages(db_page *page, int parentRecordPos, db_page *parentPa
         parentPage->remove(parentRecordPos);
         parentPage->reconnect(parentRecordPos, page->id());
         if (page->hasChildren()) page->reconnect((int) page->recordCount(), rightNextPage->lastRightChild());
-        _dataStorage->deallocatePage(rightNextPage->id());
+        _freePage(rightNextPage->id());
 
     } else if (leftPrevPage->usedBytes() + basicResultSize < page->size()) {
 
@@ -265,16 +455,243 @@ void database::_mergePages(db_page *page, int parentRecordPos, db_page *parentPa
         for (int i = (int) leftPrevPage->recordCount() - 1; i >= 0; --i) {
             page->insert(0, leftPrevPage->recordAt(i), page->hasChildren() ? leftPrevPage->childAt(i) : -1);
         }
-        _dataStorage->deallocatePage(leftPrevPage->id());
+        _freePage(leftPrevPage->id());
         parentPage->remove(parentRecordPos - 1);
     } else {
-        assert(0); // todo handle this situation properly (can't merge pages though they are both not minimally filled)
+        // can't merge pages though they are both not minimally filled: the page remains underfull
+        // (this is still a valid tree and it happens only with records large compared to the page size)
+        return false;
+    }
+
+    return true;
+}
+
+
+void database::removeRange(data_blob startKey, data_blob endKey)
+{
+    if (_binaryKeyComparer(endKey, startKey)) return;
+
+    std::unique_lock<std::mutex> lock(_operationsMutex);
+    if (_hashIndex != nullptr) _hashIndex->clear();
+    if (_recordCache != nullptr) _recordCache->clear();
+
+    db_operation operation(_currentOperationId++);
+    _dataStorage->onOperationStart(&operation);
+
+    // first drop all the subtrees covered by the range leaving only the two boundary paths trimmed,
+    // then fix the underfull pages on these paths and finally remove the only in-range key that was kept
+    // to separate them (where the paths fork)
+    key_value_copy separator;
+    _rRemoveRange(_dataStorage->rootPageId(), _treeHeight(), false, false, startKey, endKey, separator);
+
+    while (_rebalanceUnderfullOnPath(startKey) || _rebalanceUnderfullOnPath(endKey));
+
+    if (separator.key.valid()) {
+        _rKeyErasingLookup(_dataStorage->rootPageId(), -1, -1, separator.key);
+        separator.release();
+    }
+
+    _dataStorage->onOperationEnd();
+    if (_residentLevelsStale) _refreshResidentLevels();
+
+    _waitCommitted(lock);
+}
+
+
+void database::truncate()
+{
+    std::unique_lock<std::mutex> lock(_operationsMutex);
+
+    _deferredRebalances.clear();
+    if (_hashIndex != nullptr) _hashIndex->clear();
+    if (_keyFilter != nullptr) _keyFilter->clear();
+    if (_recordCache != nullptr) _recordCache->clear();
+
+    _dataStorage->deallocateAllPages();
+
+    db_operation operation(_currentOperationId++);
+    _dataStorage->onOperationStart(&operation);
+
+    db_page *rootPage = _dataStorage->allocatePage(true);
+    _changeRootPage(rootPage->id());
+    _dataStorage->writeAndRelease(rootPage);
+
+    _dataStorage->onOperationEnd();
+    if (_residentLevelsStale) _refreshResidentLevels();
+
+    _waitCommitted(lock);
+}
+
+
+int database::_treeHeight()
+{
+    int levels = 0;
+    db_page *page = _dataStorage->fetchPage(_dataStorage->rootPageId());
+
+    while (page->hasChildren()) {
+        int nextPageId = page->childAt(0);
+        _dataStorage->releasePage(page);
+
+        page = _dataStorage->fetchPage(nextPageId);
+        ++levels;
+    }
+
+    _dataStorage->releasePage(page);
+    return levels;
+}
+
+
+void database::_rRemoveRange(int pageId, int levelsBelow, bool lowerCovered, bool upperCovered,
+                             data_blob startKey, data_blob endKey, key_value_copy &separator)
+{
+    db_page *page = _dataStorage->fetchPage(pageId);
+
+    // records [firstPos, endPos) are in range
+    int firstPos = lowerCovered ? 0 :
+                   std::lower_bound(page->keysBegin(), page->keysEnd(), startKey, _binaryKeyComparer).position();
+    int endPos = upperCovered ? (int) page->recordCount() :
+                 std::upper_bound(page->keysBegin(), page->keysEnd(), endKey, _binaryKeyComparer).position();
+
+    if (!page->hasChildren()) {
+        _removeFromKeyFilter(page, firstPos, endPos);
+        for (int i = endPos - 1; i >= firstPos; --i) {
+            page->remove(i);
+        }
+
+        if (firstPos < endPos) _dataStorage->writeAndRelease(page);
+        else _dataStorage->releasePage(page);
+        return;
+    }
+
+    std::vector<int> children;
+    for (int i = firstPos; i <= endPos; ++i) {
+        children.push_back(page->childAt(i));
+    }
+
+    // where the boundary paths fork one in-range key has to stay for a while to separate them
+    bool keepSeparator = !lowerCovered && !upperCovered && firstPos < endPos;
+    if (keepSeparator) separator = key_value_copy(page->recordAt(firstPos));
+    _dataStorage->releasePage(page);
+
+    for (int i = firstPos; i <= endPos; ++i) {
+        bool childLowerCovered = i > firstPos || lowerCovered;
+        bool childUpperCovered = i < endPos || upperCovered;
+
+        if (childLowerCovered && childUpperCovered) {
+            _freeSubtree(children[i - firstPos], levelsBelow - 1);
+        } else {
+            _rRemoveRange(children[i - firstPos], levelsBelow - 1, childLowerCovered, childUpperCovered,
+                          startKey, endKey, separator);
+        }
+    }
+
+    if (firstPos == endPos) return;
+
+    page = _dataStorage->fetchPage(pageId);
+    _removeFromKeyFilter(page, keepSeparator ? firstPos + 1 : firstPos, endPos);    // the separator is removed later
+    if (keepSeparator) {
+        for (int i = endPos - 1; i > firstPos; --i) {
+            page->remove(i);
+        }
+
+    } else if (lowerCovered) {
+        for (int i = endPos - 1; i >= firstPos; --i) {
+            page->remove(i);
+        }
+
+    } else {    // the only partially covered child becomes the last one
+        int partialChildId = page->childAt(firstPos);
+        for (int i = endPos - 1; i >= firstPos; --i) {
+            page->remove(i);
+        }
+        page->reconnect(firstPos, partialChildId);
+    }
+
+    if (page->wasChanged()) _dataStorage->writeAndRelease(page);
+    else _dataStorage->releasePage(page);
+}
+
+
+void database::_freeSubtree(int pageId, int levelsBelow)
+{
+    // leaves are freed without being read unless their keys have to be removed from the key filter
+    if (levelsBelow > 0 || _keyFilter != nullptr) {
+        db_page *page = _dataStorage->fetchPage(pageId);
+        if (levelsBelow > 1 || (levelsBelow > 0 && _keyFilter != nullptr)) _prefetchChildren(page);
+        _removeFromKeyFilter(page, 0, (int) page->recordCount());
+
+        std::vector<int> children;
+        for (int i = 0; levelsBelow > 0 && i <= page->recordCount(); ++i) {
+            children.push_back(page->childAt(i));
+        }
+        _dataStorage->releasePage(page);
+
+        for (int childId : children) {
+            _freeSubtree(childId, levelsBelow - 1);
+        }
+    }
+
+    _freePage(pageId);
+}
+
+
+void database::_freePage(int pageId)
+{
+    if (_dataStorage->pagesCache().isResident(pageId)) _residentLevelsStale = true;    // the level shrinks
+    _deferredRebalances.erase(pageId);    // its id may be given to another page
+    _dataStorage->deallocatePage(pageId);
+}
+
+
+void database::_removeFromKeyFilter(db_page *page, int firstPos, int endPos)
+{
+    if (_keyFilter == nullptr) return;
+
+    for (int i = firstPos; i < endPos; ++i) {
+        _keyFilter->remove(page->keyAt(i));
+    }
+}
+
+
+bool database::_rebalanceUnderfullOnPath(data_blob key)
+{
+    int parentPageId = -1, parentRecordPos = -1;
+    int pageId = _dataStorage->rootPageId();
+
+    while (true) {
+        db_page *page = _dataStorage->fetchPage(pageId);
+
+        if (parentPageId != -1 && !page->isMinimallyFilled()) {
+            size_t usedBytes = page->usedBytes();
+            _makePageMinimallyFilled(page, parentPageId, parentRecordPos);
+
+            bool changed = page->usedBytes() != usedBytes;
+            _dataStorage->releasePage(page);
+            if (changed) {
+                _checkAndRemoveEmptyRoot();
+                return true;
+            }
+
+            page = _dataStorage->fetchPage(pageId);    // nothing can be done with it so go deeper
+        }
+
+        if (!page->hasChildren()) {
+            _dataStorage->releasePage(page);
+            return false;
+        }
+
+        auto keyIt = std::lower_bound(page->keysBegin(), page->keysEnd(), key, _binaryKeyComparer);
+        parentPageId = pageId;
+        parentRecordPos = keyIt.position();
+        pageId = keyIt.child();
+        _dataStorage->releasePage(page);
     }
 }
 
 
 string database::dumpTree() const
 {
+    std::lock_guard<std::mutex> lock(_operationsMutex);
     std::ostringstream info;
     info << "dumping tree =========================================================================" << std::endl;
 
@@ -287,6 +704,7 @@ string database::dumpTree() const
 void database::_dump(std::ostringstream &info, int pageId) const
 {
     db_page *page = _dataStorage->fetchPage(pageId);
+    _prefetchChildren(page);
     info << "page #" << pageId << ": (has_links=" << page->hasChildren() << "; is_full="
     << page->isFull() << "; is_minimally_filled=" << page->isMinimallyFilled() << ") " << std::endl;
 
@@ -312,12 +730,126 @@ void database::_dump(std::ostringstream &info, int pageId) const
 
 void database::remove(data_blob key)
 {
+    std::unique_lock<std::mutex> lock(_operationsMutex);
+
     db_operation operation(_currentOperationId++);
     _dataStorage->onOperationStart(&operation);
 
     _rKeyErasingLookup(_dataStorage->rootPageId(), -1, -1, key);
+    if (_hashIndex != nullptr) _hashIndex->invalidate(key);
+    if (_recordCache != nullptr) _recordCache->invalidate(key);
 
     _dataStorage->onOperationEnd();
+    if (_residentLevelsStale) _refreshResidentLevels();
+
+    // the flagged pages are rebalanced a few at a time, so that no delete pays for all of them
+    if (_deferredRebalances.size() >= _maxDeferredRebalances) {
+        _rebalanceDeferred(rebalancesPerRemove);
+    }
+
+    _waitCommitted(lock);
+}
+
+
+void database::compact()
+{
+    std::unique_lock<std::mutex> lock(_operationsMutex);
+    _rebalanceDeferred(_deferredRebalances.size());
+    _waitCommitted(lock);
+}
+
+
+void database::_rebalanceDeferred(size_t pagesCount)
+{
+    for (size_t i = 0; i < pagesCount && !_deferredRebalances.empty(); ++i) {
+        int pageId = *_deferredRebalances.begin();
+        _deferredRebalances.erase(_deferredRebalances.begin());
+
+        db_operation operation(_currentOperationId++);
+        _dataStorage->onOperationStart(&operation);
+
+        // the page could have been filled up or become the root since it was flagged
+        db_page *page = _dataStorage->fetchPage(pageId);
+        bool underfull = !page->isMinimallyFilled() && page->recordCount() > 0 &&
+                         pageId != _dataStorage->rootPageId();
+        data_blob_copy key = underfull ? data_blob_copy(page->keyAt(0)) : data_blob_copy();
+        _dataStorage->releasePage(page);
+
+        while (underfull && _rebalanceUnderfullOnPath(key));
+
+        _dataStorage->onOperationEnd();
+        key.release();
+    }
+
+    if (_residentLevelsStale) _refreshResidentLevels();
+}
+
+
+void database::setCacheSize(size_t sizeBytes)
+{
+    std::lock_guard<std::mutex> lock(_operationsMutex);
+    _dataStorage->resizeCache(std::max(sizeBytes / _dataStorage->pageSize(), (size_t) 1));
+    _refreshResidentLevels();    // they are limited by the cache size
+}
+
+
+void database::flush()
+{
+    std::lock_guard<std::mutex> lock(_operationsMutex);
+    _dataStorage->checkpoint(true);
+}
+
+
+void database::_changeRootPage(int pageId)
+{
+    _dataStorage->changeRootPage(pageId);
+    _residentLevelsStale = true;    // the pages are chosen again when the operation ends
+}
+
+
+void database::_refreshResidentLevels()
+{
+    _residentLevelsStale = false;
+    if (_residentTreeLevels == 0) return;
+
+    size_t maxResidentPages = _dataStorage->pagesCache().statistics().sizePages / 2;
+    std::vector<int> residentPages;
+    std::vector<int> levelPages { _dataStorage->rootPageId() };
+
+    // whole levels are taken while they consist of internal pages and fit the limit
+    for (size_t level = 0; level < _residentTreeLevels && !levelPages.empty(); ++level) {
+        if (residentPages.size() + levelPages.size() > maxResidentPages) break;
+
+        std::vector<int> nextLevelPages;
+        bool internalLevel = true;
+        for (int pageId : levelPages) {
+            db_page *page = _dataStorage->fetchPage(pageId);
+            internalLevel = page->hasChildren();
+
+            for (int i = 0; internalLevel && i <= page->recordCount(); ++i) {
+                nextLevelPages.push_back(page->childAt(i));
+            }
+            _dataStorage->releasePage(page);
+
+            if (!internalLevel) break;
+        }
+
+        if (!internalLevel) break;
+        residentPages.insert(residentPages.end(), levelPages.begin(), levelPages.end());
+        levelPages.swap(nextLevelPages);
+    }
+
+    _dataStorage->setResidentPages(residentPages);
+}
+
+
+bool database::_deferRebalance(db_page *page)
+{
+    // an empty page can't be left as is because it has no keys to be found by
+    if (!_deferredRebalancing || page->recordCount() == 0) return false;
+
+    _deferredRebalances.insert(page->id());
+    return true;
 }
 
 
@@ -335,6 +867,11 @@ bool database::_removeFromLeaf(db_page *page, int recPos, int parentPageId, int
         return false;
     }
 
+    if (_deferRebalance(page)) {
+        _dataStorage->writeAndRelease(page);
+        return false;
+    }
+
     bool ret = _makePageMinimallyFilled(page, parentPageId, parentRecordPos);
     _dataStorage->releasePage(page);
     return ret;
@@ -361,6 +898,7 @@ db_page *database::_findPageNeighbours(const record_internal_id &parentRecord, i
 
 string database::dumpSortedKeys() const
 {
+    std::lock_guard<std::mutex> lock(_operationsMutex);
     std::ostringstream info;
     _rDumpSortedKeys(info, _dataStorage->rootPageId());
     return info.str();
@@ -370,6 +908,7 @@ string database::dumpSortedKeys() const
 void database::_rDumpSortedKeys(std::ostringstream &info, int pageId) const
 {
     db_page *page = _dataStorage->fetchPage(pageId);
+    _prefetchChildren(page);
     info << "\tpage #" << pageId << ": (has_links=" << page->hasChildren() << ")" << std::endl;
 
     for (auto elementIt = page->keysBegin(); elementIt != page->keysEnd(); ++elementIt) {
@@ -393,7 +932,7 @@ bool database::_tryTakeFromNearest(db_page *page, db_page *parentPage, int paren
 {
     if (leftPrevPage != nullptr) {
         int leftPrevMedianPos = (int) leftPrevPage->recordCount() - 1;
-        if (leftPrevPage->willRemainMinimallyFilledWithout(leftPrevMedianPos)) {
+        if (leftPrevMedianPos >= 0 && leftPrevPage->willRemainMinimallyFilledWithout(leftPrevMedianPos)) {
 
             key_value_copy medianElement(leftPrevPage->recordAt(leftPrevMedianPos));
             int leftLastLink = leftPrevPage->hasChildren() ? leftPrevPage->lastRightChild() : -1;
@@ -414,7 +953,7 @@ bool database::_tryTakeFromNearest(db_page *page, db_page *parentPage, int paren
     } else {     // I assume here that rightNextPageId != -1
 
         int rightNextMedianPos = 0;
-        if (rightNextPage->willRemainMinimallyFilledWithout(rightNextMedianPos)) {
+        if (rightNextPage->recordCount() > 0 && rightNextPage->willRemainMinimallyFilledWithout(rightNextMedianPos)) {
 
             key_value_copy medianElement(rightNextPage->recordAt(rightNextMedianPos));
             int rightMedLink = rightNextPage->hasChildren() ? rightNextPage->childAt(rightNextMedianPos) : -1;
@@ -446,8 +985,9 @@ void database::_checkAndRemoveEmptyRoot()
     }
 
     int actualRootId = rootPage->lastRightChild();
+    _deferredRebalances.erase(rootPage->id());
     _dataStorage->deallocateAndRelease(rootPage);
-    _dataStorage->changeRootPage(actualRootId);
+    _changeRootPage(actualRootId);
 }
 
 
@@ -489,7 +1029,7 @@ bool database::_rRemoveFromNodeR(int pageId, int parentPageId, int parentRecPos,
             return false;
         }
 
-        if (canRebalance) {
+        if (canRebalance && !_deferRebalance(page)) {
             bool ret = _makePageMinimallyFilled(page, parentPageId, parentRecPos);
             _dataStorage->releasePage(page);
             return ret;
@@ -516,7 +1056,7 @@ bool database::_testRebalanceAfterDelete(int pageId, int parentPageId, int paren
     if (pageId != _dataStorage->rootPageId()) {
         db_page *page = _dataStorage->fetchPage(pageId);
         bool ret = false;
-        if (!page->isMinimallyFilled()) {
+        if (!page->isMinimallyFilled() && !_deferRebalance(page)) {
             ret = _makePageMinimallyFilled(page, parentPageId, parentRecPos);
         }
         _dataStorage->releasePage(page);
@@ -530,45 +1070,120 @@ bool database::_testRebalanceAfterDelete(int pageId, int parentPageId, int paren
 
 data_blob_copy database::_lookupByKey(data_blob key)
 {
-    int nextPageId = _dataStorage->rootPageId();
+    db_page *page = _dataStorage->fetchPage(_dataStorage->rootPageId());
 
     while (true) {
-        db_page *page = _dataStorage->fetchPage(nextPageId);
         auto keyIt = std::lower_bound(page->keysBegin(), page->keysEnd(), key, _binaryKeyComparer);
 
         if (keyIt == page->keysEnd()) {    // key not found
             if (!page->hasChildren()) {
                 _dataStorage->releasePage(page);
+                if (_hashIndex != nullptr) _hashIndex->invalidate(key);
                 return data_blob_copy();
             }
         } else {
 
             if (_keysEqual(key, *keyIt)) {
+                if (_hashIndex != nullptr) {
+                    _hashIndex->onLookup(key, page->id(), keyIt.position(), page->lastModifiedOpId());
+                }
+
+                data_blob_copy value(keyIt.value());
                 _dataStorage->releasePage(page);
-                return data_blob_copy(keyIt.value());
+                return value;
             } else {
                 if (!page->hasChildren()) {   // also not found
                     _dataStorage->releasePage(page);
+                    if (_hashIndex != nullptr) _hashIndex->invalidate(key);
                     return data_blob_copy();
                 }
             }
         }
 
-        nextPageId = keyIt.child();
+        db_page *childPage = _dataStorage->fetchChildPage(page, keyIt.position());
         _dataStorage->releasePage(page);
+        page = childPage;
     }
 }
 
 
 string database::dumpCacheStatistics() const
 {
+    std::lock_guard<std::mutex> lock(_operationsMutex);
     std::ostringstream str;
     auto cacheStatistics = _dataStorage->pagesCache().statistics();
 
+    str << "cache size pages: " << cacheStatistics.sizePages << std::endl;
+    str << "cached pages: " << cacheStatistics.cachedPages << std::endl;
+    str << "cache memory bytes: " << cacheStatistics.memoryBytes << std::endl;
     str << "fetches: " << cacheStatistics.fetchesCount << std::endl;
     str << "misses: " << cacheStatistics.missesCount << std::endl;
     str << "evictions: " << cacheStatistics.ecivtionsCount << std::endl;
     str << "failed evictions: " << cacheStatistics.failedEvictions << std::endl;
+    str << "overflow frames: " << cacheStatistics.overflowFrames << std::endl;
+    str << "dirty evictions: " << cacheStatistics.dirtyEvictions << std::endl;
+    str << "background writes: " << cacheStatistics.backgroundWrites << std::endl;
+    str << "prefetch reads: " << cacheStatistics.prefetchReads << std::endl;
+    str << "prefetch hits: " << cacheStatistics.prefetchHits << std::endl;
+    str << "prefetched unused: " << cacheStatistics.prefetchWasted << std::endl;
+    str << "preloaded pages: " << cacheStatistics.preloadedPages << std::endl;
+    str << "resident pages: " << cacheStatistics.residentPages << std::endl;
+    str << "resident hits: " << cacheStatistics.residentHits << std::endl;
+    str << "swizzled pages: " << cacheStatistics.swizzledPages << std::endl;
+    str << "swizzled hits: " << cacheStatistics.swizzledHits << std::endl;
+    str << "compressed pages: " << cacheStatistics.compressedPages << std::endl;
+    str << "compressed bytes: " << cacheStatistics.compressedBytes << std::endl;
+    str << "compressed hits: " << cacheStatistics.compressedHits << std::endl;
+    str << "compressed rejected: " << cacheStatistics.compressedRejected << std::endl;
+    str << "flushes: " << cacheStatistics.flushes << std::endl;
+    str << "flushed pages: " << cacheStatistics.flushedPages << std::endl;
+    str << "flush writes: " << cacheStatistics.flushWrites << std::endl;
+    str << "flush time us: " << cacheStatistics.flushMicroseconds << std::endl;
+    str << "last flush time us: " << cacheStatistics.lastFlushMicroseconds << std::endl;
+    str << "checkpoints: " << _dataStorage->checkpointsCount() << std::endl;
+    str << "checkpoint writes: " << cacheStatistics.checkpointWrites << std::endl;
+
+    static const char *const durabilityNames[] = { "none", "async", "per commit", "group commit" };
+    auto commitStatistics = _dataStorage->commitStatistics();
+    str << "log durability: " << durabilityNames[(int) _dataStorage->logDurability()] << std::endl;
+    str << "commits: " << commitStatistics.commits << std::endl;
+    str << "log syncs: " << commitStatistics.syncs << std::endl;
+    str << "log writes: " << commitStatistics.writes << std::endl;
+    str << "commit time us: " << commitStatistics.commitMicroseconds << std::endl;
+    str << "max commit time us: " << commitStatistics.maxCommitMicroseconds << std::endl;
+    str << "cache shards: " << _dataStorage->pagesCache().shardsCount() << std::endl;
+
+    auto &replacementPolicy = _dataStorage->pagesCache().replacementPolicy();
+    for (size_t queue = 0; queue < replacementPolicy.queuesCount(); ++queue) {
+        str << "hits in " << replacementPolicy.queueName(queue) << ": " << cacheStatistics.queueHits[queue] << std::endl;
+    }
+    str << "deferred rebalances: " << _deferredRebalances.size() << std::endl;
+
+    if (_hashIndex != nullptr) {
+        auto hashIndexStatistics = _hashIndex->statistics();
+        str << "hash index entries: " << _hashIndex->size() << std::endl;
+        str << "hash index hits: " << hashIndexStatistics.hits << std::endl;
+        str << "hash index stale entries: " << hashIndexStatistics.staleEntries << std::endl;
+    }
+
+    if (_keyFilter != nullptr) {
+        auto keyFilterStatistics = _keyFilter->statistics();
+        str << "key filter memory bytes: " << _keyFilter->memoryBytes() << std::endl;
+        str << "key filter keys: " << _keyFilter->keysCount() << std::endl;
+        str << "key filter filtered lookups: " << keyFilterStatistics.filteredLookups << std::endl;
+        str << "key filter false positives: " << keyFilterStatistics.falsePositives << std::endl;
+        str << "key filter false positive rate: " << _keyFilter->observedFalsePositiveRate() <<
+            " (expected " << _keyFilter->expectedFalsePositiveRate() << ")" << std::endl;
+    }
+
+    if (_recordCache != nullptr) {
+        auto recordCacheStatistics = _recordCache->statistics();
+        str << "record cache memory bytes: " << _recordCache->memoryBytes() << std::endl;
+        str << "record cache records: " << _recordCache->size() << std::endl;
+        str << "record cache hits: " << recordCacheStatistics.hits << std::endl;
+        str << "record cache misses: " << recordCacheStatistics.misses << std::endl;
+        str << "record cache evictions: " << recordCacheStatistics.evictions << std::endl;
+    }
 
     return str.str();
 }
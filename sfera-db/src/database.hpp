@@ -5,6 +5,14 @@
 //----------------------------------------------------------------------------------------------------------------------
 
 #include "db_data_storage.hpp"
+#include "db_hash_index.hpp"
+#include "db_key_filter.hpp"
+#include "db_record_cache.hpp"
+
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <mutex>
 
 //----------------------------------------------------------------------------------------------------------------------
 
@@ -15,8 +23,40 @@ namespace sfera_db
     {
         size_t maxDBSize          = 0;
         size_t pageSizeBytes      = 2048;
-        size_t cacheSizePages     = 16;
+        size_t cacheSizePages     = 16;     // 0 on opening - the size the database has been closed with
         size_t maxDataEntryLength = 80;
+        pages_replacement_policy cacheReplacementPolicy = pages_replacement_policy::lru;   // lru, clock, 2Q, ARC or LRU-2
+        bool   cacheHugePages     = false;  // back the pages cache frames with huge pages (if supported)
+        size_t cacheShards        = 0;      // independently locked parts of the pages cache (0 - by the cache size)
+        bool   cacheStrictSize    = false;  // operations fail to start rather than leave the cache over its size
+
+        size_t   backgroundWriterPagesPerSecond = 0;    // cleans dirty pages ahead of eviction (0 - disabled)
+        unsigned backgroundWriterCleanPercent   = 25;   // low watermark of free or clean pages in the cache
+        size_t   prefetchThreads = 0;                   // child pages read-ahead for whole tree walks (0 - disabled)
+        cache_preload_mode cachePreload = cache_preload_mode::none;    // read the pages cached at the last close
+        size_t   residentTreeLevels = 0;    // top internal levels kept apart from the cache policy (up to half the cache)
+        bool     swizzleChildPointers = false;  // lookups follow direct links from cached parents to cached children
+        size_t   cacheCompressedBytes = 0;      // second tier of compressed evicted pages, resized with the cache (0 - off)
+        size_t   flushThreads = 0;              // parallel writes of the dirty pages on flush and close
+        size_t   checkpointIntervalSeconds = 0; // fuzzy checkpoints bound the recovery replay (0 - no time trigger)
+        size_t   checkpointLogBytes = 0;        // a checkpoint after so much log written (0 - no log size trigger)
+        size_t   logSegmentBytes = 16 << 20;    // preallocated log files, removed once older than a checkpoint
+        bool     logPageChanges = false;        // log the inserts and removes made in the pages, not the whole pages
+        log_durability logDurability = log_durability::none;    // none, async, per commit or group commit syncs
+        size_t   logSyncIntervalMs = 10;        // async durability: the log is synced in the background so often
+        size_t   recoveryThreads = 0;           // write the pages recovered after a crash (0 - a thread per core)
+        size_t   logBufferBytes = 256 << 10;    // the log records are gathered and written in file system blocks
+
+        bool   deferredRebalancing   = false;   // deletes only flag underfull pages, compact() rebalances them
+        size_t maxDeferredRebalances = 1024;    // past so many flagged pages each delete rebalances a few of them
+
+        size_t hashIndexEntries          = 0;   // adaptive hash index for hot keys (0 - disabled)
+        size_t hashIndexAdmissionLookups = 3;   // a key is admitted after so many lookups
+
+        size_t   keyFilterSizeBytes  = 0;       // counting bloom filter over the keys (0 - disabled)
+        unsigned keyFilterHashes     = 4;
+
+        size_t recordCacheSizeBytes = 0;        // copies of hot values apart from the pages cache (0 - disabled)
     };
 
 //----------------------------------------------------------------------------------------------------------------------
@@ -48,15 +88,43 @@ namespace sfera_db
             bool empty() const  { return !requestedRecord.valid(); }
         };
 
+        static const size_t rebalancesPerRemove = 4;    // past the deferred rebalances limit
+
 //----------------------------------------------------------------------------------------------------------------------
 
     private:
+        // one operation at a time, with group commit the operations of other threads are logged while one waits
+        // for its sync
+        mutable std::mutex _operationsMutex;
+
         size_t _maxDataEntryLength = 0;
         db_data_storage *_dataStorage = nullptr;
         uint64_t _currentOperationId = 1;
 
+        bool _deferredRebalancing = false;
+        size_t _maxDeferredRebalances = 0;
+        std::unordered_set<int> _deferredRebalances;    // underfull pages, kept across the sessions
+
+        db_hash_index *_hashIndex = nullptr;
+        db_key_filter *_keyFilter = nullptr;
+        db_record_cache *_recordCache = nullptr;
+
+        size_t _residentTreeLevels = 0;
+        bool _residentLevelsStale = false;    // the root or a resident level has changed since they were chosen
+
     private:
+        static pages_cache_config _pagesCacheConfig(const database_config &config);
+        static checkpoint_config _checkpointConfig(const database_config &config);
+        static binlog_config _binlogConfig(const database_config &config);
+        void _applyRuntimeConfig(const database_config &config);
+        void _rFillKeyFilter(int pageId);
+        void _prefetchChildren(db_page *page) const;
+        void _changeRootPage(int pageId);
+        void _refreshResidentLevels();
+        void _waitCommitted(std::unique_lock<std::mutex> &lock);
+
         data_blob_copy _lookupByKey(data_blob key);
+        bool _lookupByHashIndex(data_blob key, data_blob_copy &result);
         void _rKeyInsertionLookup(int pageId, int parentPageId, int parentRecordPos, const key_value &element);
         bool _rKeyErasingLookup(int pageId, int parentPageId, int parentRecordPos, const data_blob &element);
         db_page *_splitPage(db_page *page, db_page *parentPage, int parentRecordPos, const key_value &element);
@@ -72,8 +140,17 @@ namespace sfera_db
         db_page *_findPageNeighbours(const record_internal_id &parentRecord, int &leftPrevPageId, int &rightNextPageId);
         bool _tryTakeFromNearest(db_page *page, db_page *parentPage, int parentRecPos,
                                  db_page *leftPrevPage, db_page *rightNextPage);
-        void _mergePages(db_page *page, int parentRecordPos, db_page *parentPage, db_page *rightNextPage,
+        bool _mergePages(db_page *page, int parentRecordPos, db_page *parentPage, db_page *rightNextPage,
                          db_page *leftPrevPage);
+        int _treeHeight();
+        void _rRemoveRange(int pageId, int levelsBelow, bool lowerCovered, bool upperCovered,
+                           data_blob startKey, data_blob endKey, key_value_copy &separator);
+        void _freeSubtree(int pageId, int levelsBelow);
+        void _freePage(int pageId);
+        void _removeFromKeyFilter(db_page *page, int firstPos, int endPos);
+        bool _rebalanceUnderfullOnPath(data_blob key);
+        bool _deferRebalance(db_page *page);
+        void _rebalanceDeferred(size_t pagesCount);
 
         void _dump(std::ostringstream &info, int pageId) const;
         void _rDumpSortedKeys(std::ostringstream &info, int pageId) const;
@@ -84,13 +161,18 @@ namespace sfera_db
 
     public:
         static database* createEmpty(const std::string &path, const database_config &config);
-        static database* openExisting(const std::string &path);
+        static database* openExisting(const std::string &path, const database_config &config = database_config());
         static bool exists(const std::string &path);
         ~database();
 
         void insert(data_blob key, data_blob value);
         data_blob_copy get(data_blob key);
         void remove(data_blob key);
+        void removeRange(data_blob startKey, data_blob endKey);
+        void truncate();
+        void compact();
+        void setCacheSize(size_t sizeBytes);    // may be called on a working database
+        void flush();    // writes all the changed pages to the storage file and takes a checkpoint
 
         string dumpTree() const;
         string dumpSortedKeys() const;
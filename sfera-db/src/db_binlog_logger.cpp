@@ -4,6 +4,12 @@
 
 #include <iostream>
 #include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <algorithm>
+#include <exception>
+#include <atomic>
 
 //----------------------------------------------------------------------------------------------------------------------
 
@@ -11,6 +17,9 @@ namespace sfera_db
 {
 //----------------------------------------------------------------------------------------------------------------------
 
+const size_t binlog_record::_headerSize;
+
+
 binlog_record::binlog_record(type_t t, uint64_t lsn) :
         _type(t),
         _lsn(lsn)
@@ -58,17 +67,13 @@ void binlog_record::_unpackHeader(uint8_t *header)
 }
 
 
-void binlog_record::writeTo(raw_file *file)
+void binlog_record::writeTo(binlog_writer &writer)
 {
     uint8_t header[_headerSize];
     _fillHeader(header);
 
-    std::pair<const void *, size_t> buffers[] = {
-            {header,   sizeof(header)},
-            {&_length, sizeof(_length)}
-    };
-
-    file->appedAll(buffers, 2);
+    writer.append(header, sizeof(header));
+    writer.append(&_length, sizeof(_length));
 }
 
 
@@ -88,6 +93,22 @@ bool binlog_record::readFrom(raw_file *file)
 }
 
 
+bool binlog_record::readHeaderAt(const raw_file *file, off_t offset)
+{
+    uint8_t header[_headerSize];
+    if (!file->tryReadAll(offset, header, _headerSize)) return false;
+    _unpackHeader(header);
+
+    // the rest of a segment is preallocated, the last record may be written partially
+    if (_type == UNKNOWN || _length < _headerSize + sizeof(_length)) return false;
+    if ((size_t) offset + _length > file->actualSize()) return false;
+
+    uint32_t trailingLength = 0;
+    if (!file->tryReadAll(offset + _length - sizeof(_length), &trailingLength, sizeof(trailingLength))) return false;
+    return trailingLength == _length;
+}
+
+
 binlog_record::type_t
 binlog_record::fetchType(raw_file *file)
 {
@@ -107,35 +128,31 @@ binlog_operation_record::binlog_operation_record(binlog_record::type_t t, uint64
 {
     auto pagesCount = _operation->pagesWriteSet().size();
     _length += sizeof(uint32_t) /* pagesCount */ +
-               (_operation->pagesWriteSet().begin()->second->size() + sizeof(int)) * pagesCount;
+               (_operation->pagesWriteSet().begin()->page->size() + sizeof(int)) * pagesCount;
 }
 
 
-void binlog_operation_record::writeTo(raw_file *file)
+void binlog_operation_record::writeTo(binlog_writer &writer)
 {
     uint8_t header[_headerSize];
     _fillHeader(header);
 
-    auto pages = _operation->pagesWriteSet();
+    auto &pages = _operation->pagesWriteSet();
     uint32_t pagesCount = (uint32_t) pages.size();
-    uint32_t pagesIds[pagesCount];
+    writer.append(header, sizeof(header));
+    writer.append(&pagesCount, sizeof(pagesCount));
 
-    uint32_t buffersCount = (uint32_t) pages.size() + 4;
-    auto buffers = new std::pair<const void *, size_t>[buffersCount];
-    buffers[0] = {header, sizeof(header)};
-    buffers[1] = {&pagesCount, sizeof(pagesCount)};
-    buffers[2] = {pagesIds, sizeof(pagesIds)};
+    for (auto &pageEntry : pages) {
+        uint32_t pageId = (uint32_t) pageEntry.page->id();
+        writer.append(&pageId, sizeof(pageId));
+    }
 
-    auto pagesIt = pages.cbegin();
-    for (int i = 0; i < pages.size(); ++i, ++pagesIt) {
-        pagesIt->second->prepareForWriting();
-        buffers[i + 3] = {pagesIt->second->bytes(), pagesIt->second->size()};
-        pagesIds[i] = pagesIt->second->id();
+    for (auto &pageEntry : pages) {
+        pageEntry.page->prepareForWriting();
+        writer.append(pageEntry.page->bytes(), pageEntry.page->size());
     }
-    buffers[buffersCount - 1] = {&_length, sizeof(_length)};
 
-    file->appedAll(buffers, buffersCount);
-    delete buffers;
+    writer.append(&_length, sizeof(_length));
 }
 
 
@@ -147,10 +164,11 @@ bool binlog_operation_record::readFrom(raw_file *file)
     uint32_t pageCount = 0;
     file->readAll(&pageCount, sizeof(pageCount));
 
-    uint32_t pagesIds[pageCount];
-    file->readAll(pagesIds, sizeof(pagesIds));
+    std::vector<uint32_t> pagesIds(pageCount);
+    file->readAll(pagesIds.data(), pageCount * sizeof(uint32_t));
 
-    uint32_t pageSize = (uint32_t) (_length - _headerSize - sizeof(_length) - sizeof(pageCount) - sizeof(pagesIds));
+    uint32_t pageSize = (uint32_t) (_length - _headerSize - sizeof(_length) - sizeof(pageCount) -
+                                    pageCount * sizeof(uint32_t));
     pageSize /= pageCount;
 
     for (int i = 0; i < pageCount; ++i) {
@@ -167,195 +185,675 @@ bool binlog_operation_record::readFrom(raw_file *file)
 
 //----------------------------------------------------------------------------------------------------------------------
 
-db_binlog_logger *db_binlog_logger::createEmpty(const std::string &path)
+binlog_changes_record::binlog_changes_record(uint64_t lsn, db_operation *operation) :
+        binlog_record(PAGE_CHANGES, lsn),
+        _opId(operation->id())
 {
-    db_binlog_logger *binlog = new db_binlog_logger();
-    binlog->_file = raw_file::createNew(path);
-    binlog->logCheckpoint();
+    auto appendBytes = [this](const void *bytes, size_t length) {
+        _payload.insert(_payload.end(), (const uint8_t *) bytes, (const uint8_t *) bytes + length);
+    };
 
-    return binlog;
+    auto &pages = operation->pagesWriteSet();
+    uint32_t pagesCount = (uint32_t) pages.size();
+    appendBytes(&_opId, sizeof(_opId));
+    appendBytes(&pagesCount, sizeof(pagesCount));
+
+    for (auto &pageEntry : pages) {
+        int32_t pageId = pageEntry.page->id();
+        auto &changes = pageEntry.page->changes();
+        uint32_t changesLength = (uint32_t) changes.size();
+
+        appendBytes(&pageId, sizeof(pageId));
+        appendBytes(&changesLength, sizeof(changesLength));
+        appendBytes(changes.data(), changes.size());
+    }
+
+    _length += (uint32_t) _payload.size();
+}
+
+
+void binlog_changes_record::writeTo(binlog_writer &writer)
+{
+    uint8_t header[_headerSize];
+    _fillHeader(header);
+
+    writer.append(header, sizeof(header));
+    writer.append(_payload.data(), _payload.size());
+    writer.append(&_length, sizeof(_length));
+}
+
+
+bool binlog_changes_record::readFrom(raw_file *file)
+{
+    if (!binlog_record::readFrom(file)) return false;
+    ::lseek(file->unixFD(), -sizeof(_length), SEEK_CUR);  // this is to undo last length skipping
+
+    _payload.resize(_length - _headerSize - sizeof(_length));
+    file->readAll(_payload.data(), _payload.size());
+    memcpy(&_opId, _payload.data(), sizeof(_opId));
+
+    ::lseek(file->unixFD(), sizeof(_length), SEEK_CUR);
+    return true;
+}
+
+
+void binlog_changes_record::forEachPage(const std::function<void(int, const uint8_t *, size_t)> &visitor) const
+{
+    const uint8_t *reader = _payload.data() + sizeof(_opId);
+    auto readUint32 = [&reader]() {
+        uint32_t value;
+        memcpy(&value, reader, sizeof(value));
+        reader += sizeof(value);
+        return value;
+    };
+
+    uint32_t pagesCount = readUint32();
+    for (uint32_t i = 0; i < pagesCount; ++i) {
+        int pageId = (int) readUint32();
+        uint32_t changesLength = readUint32();
+
+        visitor(pageId, reader, changesLength);
+        reader += changesLength;
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+binlog_checkpoint_record::binlog_checkpoint_record(uint64_t lsn, uint64_t oldestNeededLsn) :
+        binlog_record(CHECKPOINT, lsn),
+        _oldestNeededLsn(oldestNeededLsn)
+{
+    _length += sizeof(_oldestNeededLsn);
+}
+
+
+void binlog_checkpoint_record::writeTo(binlog_writer &writer)
+{
+    uint8_t header[_headerSize];
+    _fillHeader(header);
+
+    writer.append(header, sizeof(header));
+    writer.append(&_oldestNeededLsn, sizeof(_oldestNeededLsn));
+    writer.append(&_length, sizeof(_length));
+}
+
+
+bool binlog_checkpoint_record::readFrom(raw_file *file)
+{
+    if (!binlog_record::readFrom(file)) return false;
+    ::lseek(file->unixFD(), -sizeof(_length), SEEK_CUR);  // this is to undo last length skipping
+
+    file->readAll(&_oldestNeededLsn, sizeof(_oldestNeededLsn));
+    ::lseek(file->unixFD(), sizeof(_length), SEEK_CUR);
+    return true;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+std::string db_binlog_files::segmentPath(const std::string &pathPrefix, uint32_t segment)
+{
+    char segmentName[16];
+    snprintf(segmentName, sizeof(segmentName), ".%08u", segment);
+    return pathPrefix + segmentName + ".sdbl";
+}
+
+
+bool db_binlog_files::readControl(const std::string &pathPrefix, binlog_control &control)
+{
+    if (!raw_file::exists(controlPath(pathPrefix))) return false;
+
+    std::unique_ptr<raw_file> file(raw_file::openExisting(controlPath(pathPrefix), true));
+    return file->tryReadAll(0, &control, sizeof(control)) && control.magic == binlog_control::magicHeader;
+}
+
+
+void db_binlog_files::removeSegments(const std::string &pathPrefix, uint32_t firstSegment, uint32_t endSegment)
+{
+    for (uint32_t segment = firstSegment; segment < endSegment; ++segment) {
+        if (raw_file::exists(segmentPath(pathPrefix, segment))) raw_file::remove(segmentPath(pathPrefix, segment));
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+db_binlog_logger::db_binlog_logger(const std::string &pathPrefix, const binlog_config &config) :
+        _pathPrefix(pathPrefix),
+        _config(config),
+        _writer(config.bufferBytes)
+{
+    if (_config.durability == log_durability::async) {
+        _commitThreadWorking = true;
+        _commitThread = std::thread(&db_binlog_logger::_commitThreadRoutine, this);
+    }
 }
 
 
-db_binlog_logger *db_binlog_logger::openExisting(const std::string &path, const db_binlog_recovery& recoveryTool)
+db_binlog_logger *db_binlog_logger::createEmpty(const std::string &pathPrefix, const binlog_config &config)
 {
-    db_binlog_logger *binlog = new db_binlog_logger();
-    binlog->_file = raw_file::openExisting(path);
+    // the segments of a log created before could be taken for the continuation of the new one
+    binlog_control previousControl;
+    if (db_binlog_files::readControl(pathPrefix, previousControl)) {
+        uint32_t endSegment = previousControl.lastSegment + 1;
+        while (raw_file::exists(db_binlog_files::segmentPath(pathPrefix, endSegment))) ++endSegment;
+        db_binlog_files::removeSegments(pathPrefix, previousControl.replaySegment, endSegment);
+    }
+
+    db_binlog_logger *binlog = new db_binlog_logger(pathPrefix, config);
+    binlog->_controlFile = raw_file::createNew(db_binlog_files::controlPath(pathPrefix));
+    binlog->_firstLiveSegment = binlog->_control.lastSegment + 1;
+    binlog->logCheckpoint(binlog->_currentLSN + 1);
+
+    return binlog;
+}
 
+
+db_binlog_logger *db_binlog_logger::openExisting(const std::string &pathPrefix, const binlog_config &config,
+                                                 const db_binlog_recovery &recoveryTool)
+{
     if (!recoveryTool.closedProperly()) {
         throw std::runtime_error("can't open binlog before it is repaired");
     }
 
+    db_binlog_logger *binlog = new db_binlog_logger(pathPrefix, config);
+    std::string controlPath = db_binlog_files::controlPath(pathPrefix);
+    binlog->_controlFile = raw_file::exists(controlPath) ? raw_file::openExisting(controlPath)
+                                                         : raw_file::createNew(controlPath);
+
+    // the records are written to a new segment, the old ones are removed by the first checkpoint
+    binlog->_control = recoveryTool.control();
+    binlog->_control.closedProperly = 0;
+    binlog->_control.lastSegment = recoveryTool.lastSegment();
+    binlog->_control.lastOpId = recoveryTool.lastOpId();
+    binlog->_firstLiveSegment = binlog->_control.replaySegment;
     binlog->_currentLSN = recoveryTool.lastLsn() + 1;
-    binlog->logCheckpoint();
+    binlog->logCheckpoint(binlog->_currentLSN + 1);
 
     return binlog;
 }
 
 
+void db_binlog_logger::_openNextSegment(uint64_t firstLsn)
+{
+    uint32_t segment = _control.lastSegment + 1;
+    raw_file *nextFile = raw_file::createNew(db_binlog_files::segmentPath(_pathPrefix, segment));
+    nextFile->preallocate(_config.segmentBytes);
+
+    // the segment being closed is written out (and synced) here, the writes afterwards only see the next one
+    std::unique_lock<std::mutex> lock(_syncMutex);
+    if (_file != nullptr) {
+        _writeThrough(_bufferedLsn - 1, _config.durability != log_durability::none, lock);
+        while (_ioInProgress) _ioFinished.wait(lock);
+    }
+
+    delete _file;
+    _file = nextFile;
+    _writer.startFile(_file);
+    lock.unlock();
+
+    _segmentOffset = 0;
+    _segments.emplace_back(segment, firstLsn);
+
+    _control.lastSegment = segment;
+    _writeControl();
+}
+
+
+void db_binlog_logger::_writeControl()
+{
+    _controlFile->writeAll(0, &_control, sizeof(_control));
+}
+
+
 void db_binlog_logger::_writeNextRecord(binlog_record &rec)
 {
-    rec.writeTo(_file);
+    // a record longer than a segment takes a whole segment growing over the preallocated size
+    if (_file == nullptr || (_segmentOffset > 0 && _segmentOffset + rec.length() > _config.segmentBytes)) {
+        _openNextSegment(rec.lsn());
+    }
+
+    _lastRecordSegment = _control.lastSegment;
+    _lastRecordOffset = _segmentOffset;
+
+    // the full buffer is written out to make room, it is grown only for a record longer than it
+    std::unique_lock<std::mutex> lock(_syncMutex);
+    if (_writer.freeBytes() < rec.length()) {
+        if (_writtenLsn < _bufferedLsn) _writeThrough(_bufferedLsn - 1, false, lock);
+        while (_ioInProgress) _ioFinished.wait(lock);
+        _writer.reserve(rec.length());
+    }
+
+    rec.writeTo(_writer);
+    _segmentOffset += rec.length();
+    _logSize += rec.length();
     ++_currentLSN;
+    _bufferedLsn = _currentLSN;
+}
+
+
+void db_binlog_logger::_writeThrough(uint64_t lsn, bool sync, std::unique_lock<std::mutex> &lock)
+{
+    // the records buffered while the buffer is being written are written (and synced) together by the next write
+    auto recordWritten = [&]() {
+        uint64_t reachedLsn = sync ? _durableLsn : _writtenLsn;
+        return reachedLsn > lsn || reachedLsn >= _bufferedLsn;
+    };
+
+    while (!recordWritten()) {
+        if (_ioInProgress) {
+            _ioFinished.wait(lock);
+            continue;
+        }
+
+        uint64_t targetLsn = _bufferedLsn;
+        bool writeNeeded = _writtenLsn < targetLsn;
+        binlog_writer::pending_write pendingWrite = _writer.pendingWrite();
+        _ioInProgress = true;
+        lock.unlock();
+
+        std::exception_ptr ioError;
+        try {
+            if (writeNeeded) binlog_writer::write(pendingWrite);
+            if (sync) pendingWrite.file->sync();
+        }
+        catch (...) {
+            ioError = std::current_exception();
+        }
+
+        lock.lock();
+        _ioInProgress = false;
+        if (ioError == nullptr && writeNeeded) {
+            _writer.written(pendingWrite);
+            _writtenLsn = targetLsn;
+            _commitStatistics.writes++;
+        }
+        if (ioError == nullptr && sync) {
+            _durableLsn = targetLsn;
+            _commitStatistics.syncs++;
+            _commitsSynced(_durableLsn, std::chrono::steady_clock::now());
+        }
+        _ioFinished.notify_all();
+
+        if (ioError != nullptr) std::rethrow_exception(ioError);
+    }
+}
+
+
+void db_binlog_logger::_commitsSynced(uint64_t endLsn, std::chrono::steady_clock::time_point syncedAt)
+{
+    while (!_unsyncedCommits.empty() && _unsyncedCommits.front().first < endLsn) {
+        auto commitTime = std::chrono::duration_cast<std::chrono::microseconds>(syncedAt - _unsyncedCommits.front().second);
+        uint64_t commitMicroseconds = (uint64_t) commitTime.count();
+
+        _commitStatistics.commits++;
+        _commitStatistics.commitMicroseconds += commitMicroseconds;
+        _commitStatistics.maxCommitMicroseconds = std::max(_commitStatistics.maxCommitMicroseconds, commitMicroseconds);
+        _unsyncedCommits.pop_front();
+    }
+}
+
+
+void db_binlog_logger::_commitThreadRoutine()
+{
+    std::unique_lock<std::mutex> lock(_syncMutex);
+
+    while (_commitThreadWorking) {
+        _commitWakeUp.wait_for(lock, std::chrono::milliseconds(_config.syncIntervalMs));
+
+        // a failed sync is retried by the next one
+        try {
+            if (_durableLsn < _bufferedLsn) _writeThrough(_bufferedLsn - 1, true, lock);
+        }
+        catch (const std::exception &err) {
+            std::cerr << "warning: failed to sync the binlog: " << err.what() << std::endl;
+        }
+    }
+}
+
+
+void db_binlog_logger::_stopCommitThread()
+{
+    if (!_commitThread.joinable()) return;
+
+    {
+        std::lock_guard<std::mutex> lock(_syncMutex);
+        _commitThreadWorking = false;
+    }
+    _commitWakeUp.notify_all();
+    _commitThread.join();
 }
 
 
 db_binlog_logger::~db_binlog_logger()
 {
+    _stopCommitThread();
+
     binlog_record opClose(binlog_record::LOG_CLOSED, _currentLSN);
     _writeNextRecord(opClose);
+    {
+        std::unique_lock<std::mutex> lock(_syncMutex);
+        _writeThrough(opClose.lsn(), _config.durability != log_durability::none, lock);
+    }
+
+    _control.closedProperly = 1;
+    _control.lastLsn = opClose.lsn();
+    _writeControl();
+    if (_config.durability != log_durability::none) _controlFile->sync();
+
+    delete _file;
+    delete _controlFile;
 }
 
 
-void db_binlog_logger::logOperation(db_operation *operation)
+void db_binlog_logger::syncRecord(uint64_t lsn)
 {
-    binlog_operation_record rec(binlog_record::OPERATION, _currentLSN, operation);
-    _writeNextRecord(rec);
+    if (_config.durability == log_durability::none) return;
+
+    std::unique_lock<std::mutex> lock(_syncMutex);
+    _writeThrough(lsn, true, lock);
 }
 
 
-void db_binlog_logger::logCheckpoint()
+void db_binlog_logger::waitCommitted(uint64_t lsn)
 {
-    binlog_record checkpointRec(binlog_record::CHECKPOINT, _currentLSN);
-    _writeNextRecord(checkpointRec);
+    if (_config.durability != log_durability::group_commit) return;
+
+    // the first waiter writes and syncs all the buffered records at once, the ones logged during its sync are
+    // synced by the next waiter together
+    std::unique_lock<std::mutex> lock(_syncMutex);
+    _writeThrough(lsn, true, lock);
 }
 
-//----------------------------------------------------------------------------------------------------------------------
 
-db_binlog_recovery::db_binlog_recovery(const std::string &path)
+auto db_binlog_logger::commitStatistics() const -> commit_statistics_t
 {
-    if (!raw_file::exists(path)) {
-        _file = nullptr;
-        return;
-    }
+    std::lock_guard<std::mutex> lock(_syncMutex);
+    return _commitStatistics;
+}
 
-    _file = raw_file::openExisting(path, true);
-    ::lseek(_file->unixFD(), -sizeof(uint32_t), SEEK_END);
-    uint32_t lastMsgLen = 0;
-    _file->readAll(&lastMsgLen, sizeof(lastMsgLen));
-    ::lseek(_file->unixFD(), -((off_t) lastMsgLen), SEEK_CUR);
 
-    binlog_record lastRecord;
-    if (!lastRecord.readFrom(_file)) {
-        return;
+uint64_t db_binlog_logger::logOperation(db_operation *operation)
+{
+    uint64_t lsn = _currentLSN;
+    auto loggedAt = std::chrono::steady_clock::now();
+    _control.lastOpId = std::max(_control.lastOpId, operation->id());
+
+    if (_config.pageChanges) {
+        binlog_changes_record rec(lsn, operation);
+        _writeNextRecord(rec);
+    } else {
+        binlog_operation_record rec(binlog_record::OPERATION, lsn, operation);
+        _writeNextRecord(rec);
     }
 
-    if (lastRecord.type() == binlog_record::LOG_CLOSED) {
-        _closedProperly = true;
-        _lastLsn = lastRecord.lsn();
+    std::unique_lock<std::mutex> lock(_syncMutex);
+    _unsyncedCommits.emplace_back(lsn, loggedAt);
+
+    switch (_config.durability) {
+        case log_durability::none:
+            _writeThrough(lsn, false, lock);
+            _commitsSynced(_writtenLsn, std::chrono::steady_clock::now());    // committed once written
+            break;
+
+        case log_durability::async:
+            break;
+
+        case log_durability::per_commit:
+            _writeThrough(lsn, true, lock);
+            break;
+
+        case log_durability::group_commit:
+            break;    // waited for by waitCommitted, once the next operations can be logged
     }
+
+    return lsn;
 }
 
 
-db_binlog_recovery::~db_binlog_recovery()
+void db_binlog_logger::logCheckpoint(uint64_t oldestNeededLsn)
 {
-    releaseLog();
+    binlog_checkpoint_record checkpointRec(_currentLSN, oldestNeededLsn);
+    _writeNextRecord(checkpointRec);
+
+    // the segments before the one holding the oldest needed record won't be replayed anymore
+    while (_segments.size() > 1 && _segments[1].second <= oldestNeededLsn) {
+        _segments.pop_front();
+    }
+
+    _control.checkpointSegment = _lastRecordSegment;
+    _control.checkpointOffset = _lastRecordOffset;
+    _control.replaySegment = _segments.front().first;
+
+    // the control file can't point to a checkpoint lost on a crash, the removed segments can't be needed anymore
+    {
+        std::unique_lock<std::mutex> lock(_syncMutex);
+        _writeThrough(checkpointRec.lsn(), _config.durability != log_durability::none, lock);
+    }
+    _writeControl();
+    if (_config.durability != log_durability::none) _controlFile->sync();
+
+    db_binlog_files::removeSegments(_pathPrefix, _firstLiveSegment, _control.replaySegment);
+    _firstLiveSegment = _control.replaySegment;
 }
 
+//----------------------------------------------------------------------------------------------------------------------
 
-void db_binlog_recovery::doRecovery(db_stable_storage_file *stableStorage)
+const size_t db_binlog_recovery::maxWriteRunPages;
+
+
+db_binlog_recovery::db_binlog_recovery(const std::string &pathPrefix) :
+        _pathPrefix(pathPrefix)
 {
-    _findBackCheckpoint();
+    // a directory without the control file has no log to recover
+    if (!db_binlog_files::readControl(pathPrefix, _control)) {
+        _control = binlog_control();
+        _control.closedProperly = 1;
+    }
 
-    while (!_file->eof()) {
-        binlog_record::type_t nextRecordType = binlog_record::fetchType(_file);
-        if (_file->eof()) break;
-        if (nextRecordType == binlog_record::LOG_CLOSED) break;
-        assert(nextRecordType == binlog_record::OPERATION);
+    _closedProperly = _control.closedProperly != 0;
+    _lastLsn = _control.lastLsn;
+    _lastOpId = _control.lastOpId;
+    _lastSegment = _control.lastSegment;
+}
 
-        db_operation nextOperation(0);
-        binlog_operation_record nextOperationRec(&nextOperation);
-        nextOperationRec.readFrom(_file);
 
-        auto pagesSet = nextOperation.pagesWriteSet();
-        for (auto nextPagePair : pagesSet) {
-            db_page *nextPage = nextPagePair.second;
-            db_page *stablePageVersion = stableStorage->loadPage(nextPage->id());
+void db_binlog_recovery::doRecovery(db_stable_storage_file *stableStorage, size_t threadsCount)
+{
+    uint64_t oldestNeededLsn = _readCheckpoint();
+    uint64_t expectedLsn = 0;
+    bool logEnded = false;
 
-            if (stablePageVersion == nullptr ||
-                stablePageVersion->lastModifiedOpId() < nextPage->lastModifiedOpId()) {
+    // the records are scanned forward from the oldest needed one until the log ends
+    for (uint32_t segment = _control.replaySegment; !logEnded; ++segment) {
+        std::string segmentPath = db_binlog_files::segmentPath(_pathPrefix, segment);
+        if (!raw_file::exists(segmentPath)) break;
 
-                std::cerr << "[recovery] page #" << nextPage->id() << " fixed from " <<
-                (stablePageVersion == nullptr ? 0 : stablePageVersion->lastModifiedOpId()) <<
-                " to " << nextPage->lastModifiedOpId() << std::endl;
+        std::unique_ptr<raw_file> file(raw_file::openExisting(segmentPath, true));
+        off_t offset = 0;
 
-                stableStorage->writePage(nextPage);  // replace the page in stable storage
-                _lastOpId = std::max(_lastOpId, nextPage->lastModifiedOpId());
+        binlog_record record;
+        while (record.readHeaderAt(file.get(), offset)) {
+            if (expectedLsn != 0 && record.lsn() != expectedLsn) {
+                logEnded = true;    // a segment written only in part before the crash
+                break;
             }
 
-            delete nextPage;
-            delete stablePageVersion;
+            bool needed = record.lsn() >= oldestNeededLsn;
+            if (needed && record.type() == binlog_record::OPERATION) {
+                ::lseek(file->unixFD(), offset, SEEK_SET);
+                _collectOperation(file.get());
+            } else if (needed && record.type() == binlog_record::PAGE_CHANGES) {
+                ::lseek(file->unixFD(), offset, SEEK_SET);
+                _collectChanges(file.get());
+            }
+
+            _lastLsn = record.lsn();
+            expectedLsn = record.lsn() + 1;
+            offset += record.length();
         }
 
-        _lastLsn = nextOperationRec.lsn();
+        _lastSegment = std::max(_lastSegment, segment);
+    }
+
+    // the segments after the end are never replayed, but the new ones mustn't be mixed with them
+    while (raw_file::exists(db_binlog_files::segmentPath(_pathPrefix, _lastSegment + 1))) ++_lastSegment;
+
+    if (threadsCount == 0) threadsCount = std::max(std::thread::hardware_concurrency(), 1u);
+    size_t pagesFixed = _writeRecoveredPages(stableStorage, threadsCount);
+    std::cerr << "[recovery] " << _recoveredPages.size() << " pages logged, " << pagesFixed << " fixed" << std::endl;
+
+    for (auto &recoveredPage : _recoveredPages) {
+        delete recoveredPage.second.page;
     }
+    _recoveredPages.clear();
 
     _closedProperly = true;
 }
 
 
-void db_binlog_recovery::_findBackCheckpoint()
+uint64_t db_binlog_recovery::_readCheckpoint()
 {
-    ::lseek(_file->unixFD(), 0, SEEK_END);
+    std::string segmentPath = db_binlog_files::segmentPath(_pathPrefix, _control.checkpointSegment);
+    if (!raw_file::exists(segmentPath)) return 0;
 
-    while (::lseek(_file->unixFD(), -sizeof(uint32_t), SEEK_CUR) != -1) {
-        uint32_t msgLen = 0;
-        _file->readAll(&msgLen, sizeof(msgLen));
-        off_t msgBegin = ::lseek(_file->unixFD(), -(off_t) msgLen, SEEK_CUR);
+    std::unique_ptr<raw_file> file(raw_file::openExisting(segmentPath, true));
 
-        binlog_record record;
-        if (!record.readFrom(_file)) {
-            _findBackLastValidRecord();      // in case if last log message was damaged
-            record.readFrom(_file);
-            return;
-        }
+    binlog_record record;
+    if (!record.readHeaderAt(file.get(), _control.checkpointOffset) || record.type() != binlog_record::CHECKPOINT) {
+        return 0;    // the whole log from the replay segment is replayed then
+    }
+
+    ::lseek(file->unixFD(), _control.checkpointOffset, SEEK_SET);
+    binlog_checkpoint_record checkpointRec;
+    checkpointRec.readFrom(file.get());
+
+    return checkpointRec.oldestNeededLsn();
+}
 
-        if (record.type() == binlog_record::CHECKPOINT) {
-            break;
-        }
 
-        ::lseek(_file->unixFD(), msgBegin, SEEK_SET);
+void db_binlog_recovery::_collectOperation(raw_file *file)
+{
+    db_operation nextOperation(0);
+    binlog_operation_record nextOperationRec(&nextOperation);
+    nextOperationRec.readFrom(file);
+
+    // the image replaces whatever has been logged for the page before
+    for (auto &nextPageEntry : nextOperation.pagesWriteSet()) {
+        db_page *nextPage = nextPageEntry.page;
+        recovered_page &recoveredPage = _recoveredPages[nextPage->id()];
+
+        recoveredPage.pageId = nextPage->id();
+        recoveredPage.changes.clear();
+        delete recoveredPage.page;
+        recoveredPage.page = nextPage;
+
+        _lastOpId = std::max(_lastOpId, nextPage->lastModifiedOpId());
     }
 }
 
 
-void db_binlog_recovery::_findBackLastValidRecord()
+void db_binlog_recovery::_collectChanges(raw_file *file)
 {
-    const size_t readBufferSize = 512 * sizeof(uint32_t);
-    off_t currentPos = ::lseek(_file->unixFD(), 0, SEEK_END);
+    binlog_changes_record changesRec;
+    changesRec.readFrom(file);
+    uint64_t opId = changesRec.opId();
+
+    // the changes over a logged image are applied at once, the ones over the stable page wait for it to be read
+    changesRec.forEachPage([this, opId](int pageId, const uint8_t *changes, size_t changesLength) {
+        recovered_page &recoveredPage = _recoveredPages[pageId];
+        recoveredPage.pageId = pageId;
+
+        if (recoveredPage.page != nullptr) {
+            recoveredPage.page->redoChanges(changes, changesLength);
+            recoveredPage.page->wasSaved(opId);
+        } else {
+            recoveredPage.changes.emplace_back(opId, std::vector<uint8_t>(changes, changes + changesLength));
+        }
+    });
 
-    while ((currentPos = ::lseek(_file->unixFD(), -readBufferSize, SEEK_CUR)) >= 0) {
-        uint8_t readBuffer[readBufferSize];
-        _file->readAll(readBuffer, readBufferSize);
+    _lastOpId = std::max(_lastOpId, opId);
+}
 
-        uint32_t *readBufferPtr = (uint32_t *)readBuffer + (readBufferSize/sizeof(uint32_t)) - 1;
-        while (readBufferPtr >= (uint32_t *)readBuffer) {
-            for (; *readBufferPtr != binlog_record::magicHeader && readBufferPtr >= (uint32_t *)readBuffer; --readBufferPtr);
 
-            if (*readBufferPtr == binlog_record::magicHeader) {
-                uint32_t msgLength = 0;
-                off_t currentMagicPos = currentPos + (uint8_t *)readBufferPtr - readBuffer;
-                _file->readAll(currentMagicPos + sizeof(binlog_record::magicHeader), &msgLength, sizeof(msgLength));
-                //todo: test EOF
+size_t db_binlog_recovery::_writeRecoveredPages(db_stable_storage_file *stableStorage, size_t threadsCount)
+{
+    // runs of consecutive ids are written at once, the runs are taken by the threads in the file order
+    std::vector<recovered_page *> pages;
+    std::vector<std::pair<size_t, size_t>> runs;    // the first page and the pages count
+    for (auto &recoveredPage : _recoveredPages) {
+        bool continuesRun = !runs.empty() && runs.back().second < maxWriteRunPages &&
+                            recoveredPage.first == pages.back()->pageId + 1;
+        if (continuesRun) runs.back().second++;
+        else runs.emplace_back(pages.size(), 1);
+
+        pages.push_back(&recoveredPage.second);
+    }
 
-                uint32_t doubleCheckLen = 0;
-                _file->readAll(currentPos + msgLength - sizeof(msgLength), &doubleCheckLen, sizeof(doubleCheckLen));
-                if (doubleCheckLen == msgLength) {
-                    ::lseek(_file->unixFD(), currentMagicPos, SEEK_SET);
-                    return;
-                }
+    std::atomic<size_t> nextRun { 0 };
+    std::atomic<size_t> pagesFixed { 0 };
+    std::exception_ptr writeError;
+    std::mutex writeErrorMutex;
+
+    auto writeRuns = [&]() {
+        for (size_t run = nextRun++; run < runs.size(); run = nextRun++) {
+            try {
+                pagesFixed += _writeRecoveredRun(stableStorage, &pages[runs[run].first], runs[run].second);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(writeErrorMutex);
+                if (writeError == nullptr) writeError = std::current_exception();
             }
         }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < std::min(threadsCount, runs.size()); ++i) {
+        threads.emplace_back(writeRuns);
     }
+    writeRuns();
+
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    if (writeError != nullptr) std::rethrow_exception(writeError);
+    return pagesFixed;
 }
 
 
-void db_binlog_recovery::releaseLog()
+size_t db_binlog_recovery::_writeRecoveredRun(db_stable_storage_file *stableStorage, recovered_page *const *pages,
+                                              size_t pagesCount)
 {
-    if (_file != nullptr) {
-        delete _file;
-        _file = nullptr;
+    size_t pageSize = stableStorage->pageSize();
+    size_t pagesFixed = 0;
+
+    std::vector<db_page *> runPages;
+    for (size_t i = 0; i < pagesCount; ++i) {
+        recovered_page &recoveredPage = *pages[i];
+
+        // a page never written is read as zeros, its changes start with the initialization then
+        if (recoveredPage.page == nullptr) {
+            uint8_t *pageBytes = (uint8_t *) ::calloc(pageSize, 1);
+            stableStorage->readPage(recoveredPage.pageId, pageBytes);
+            recoveredPage.page = db_page::load(recoveredPage.pageId, data_blob(pageBytes, pageSize));
+
+            // the stable page may have been written after some of the operations
+            uint64_t stableOpId = recoveredPage.page->lastModifiedOpId();
+            for (auto &opChanges : recoveredPage.changes) {
+                if (opChanges.first <= stableOpId) continue;
+
+                recoveredPage.page->redoChanges(opChanges.second.data(), opChanges.second.size());
+                recoveredPage.page->wasSaved(opChanges.first);
+            }
+
+            if (recoveredPage.page->lastModifiedOpId() > stableOpId) pagesFixed++;
+        } else {
+            pagesFixed++;    // the image is the newest logged state, it is written without reading the stable page
+        }
+
+        runPages.push_back(recoveredPage.page);
     }
+
+    stableStorage->writePages(runPages.data(), runPages.size());
+    return pagesFixed;
 }
 
 //----------------------------------------------------------------------------------------------------------------------
@@ -5,9 +5,20 @@
 //----------------------------------------------------------------------------------------------------------------------
 
 #include "raw_file.hpp"
+#include "binlog_writer.hpp"
 #include "db_operation.hpp"
 #include "db_stable_storage_file.hpp"
 
+#include <deque>
+#include <map>
+#include <functional>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+
 //----------------------------------------------------------------------------------------------------------------------
 
 namespace sfera_db
@@ -16,7 +27,7 @@ namespace sfera_db
     class binlog_record
     {
     public:
-        enum type_t : uint8_t { UNKNOWN, OPERATION, LOG_CLOSED, CHECKPOINT };
+        enum type_t : uint8_t { UNKNOWN, OPERATION, LOG_CLOSED, CHECKPOINT, PAGE_CHANGES };
         static const uint32_t magicHeader = 0x109be912;
 
     protected:
@@ -24,7 +35,7 @@ namespace sfera_db
         uint32_t _length = 0;
         uint64_t _lsn  = 0;
 
-        const size_t _headerSize = sizeof(magicHeader) + sizeof(_length) + sizeof(_lsn) + sizeof(_type);
+        static const size_t _headerSize = sizeof(magicHeader) + sizeof(_length) + sizeof(_lsn) + sizeof(_type);
 
 
     protected:
@@ -38,8 +49,9 @@ namespace sfera_db
         binlog_record() { };
 
         static type_t fetchType(raw_file *file);
+        bool readHeaderAt(const raw_file *file, off_t offset);    // false if there is no whole record at the offset
 
-        virtual void writeTo(raw_file *file);
+        virtual void writeTo(binlog_writer &writer);
         virtual bool readFrom(raw_file *file);
 
         inline type_t   type() const        { return _type; }
@@ -58,8 +70,77 @@ namespace sfera_db
         binlog_operation_record(db_operation *operation) : _operation(operation) { };
         binlog_operation_record(type_t t, uint64_t lsn, db_operation *op);
 
-        virtual void writeTo(raw_file *file);
+        virtual void writeTo(binlog_writer &writer);
+        virtual bool readFrom(raw_file *file);
+    };
+
+    //----------------------------------------------------------------------------------------------------------------------
+
+    // the page operations (inserts, removes, ...) an operation has made, redone over the stable pages the operation
+    // hasn't modified yet
+    class binlog_changes_record : public binlog_record
+    {
+    protected:
+        uint64_t _opId = 0;
+        std::vector<uint8_t> _payload;    // the operation id, then the id and the changes of each page
+
+    public:
+        binlog_changes_record() { };
+        binlog_changes_record(uint64_t lsn, db_operation *operation);
+
+        virtual void writeTo(binlog_writer &writer);
+        virtual bool readFrom(raw_file *file);
+
+        void forEachPage(const std::function<void(int, const uint8_t *, size_t)> &visitor) const;    // id, changes
+        inline uint64_t opId() const  { return _opId; }
+    };
+
+    //----------------------------------------------------------------------------------------------------------------------
+
+    // the replay after a crash starts from the oldest needed record (the first change not written to the storage)
+    class binlog_checkpoint_record : public binlog_record
+    {
+    protected:
+        uint64_t _oldestNeededLsn = 0;
+
+    public:
+        binlog_checkpoint_record() { };
+        binlog_checkpoint_record(uint64_t lsn, uint64_t oldestNeededLsn);
+
+        virtual void writeTo(binlog_writer &writer);
         virtual bool readFrom(raw_file *file);
+
+        inline uint64_t oldestNeededLsn() const  { return _oldestNeededLsn; }
+    };
+
+    //----------------------------------------------------------------------------------------------------------------------
+
+    // the log is split into the preallocated segment files (prefix.00000001.sdbl, ...), the control file rewritten
+    // in place tells where the last checkpoint is and from which segment the recovery replays the log
+    struct binlog_control
+    {
+        static const uint32_t magicHeader = 0x109bc7a1;
+
+        uint32_t magic = magicHeader;
+        uint32_t closedProperly = 0;
+        uint64_t lastLsn = 0;              // of the LOG_CLOSED record
+        uint64_t lastOpId = 0;             // the operation ids go on over the sessions
+        uint32_t checkpointSegment = 0;
+        uint32_t checkpointOffset = 0;
+        uint32_t replaySegment = 0;        // holds the oldest record needed by the last checkpoint
+        uint32_t lastSegment = 0;
+    };
+
+    //----------------------------------------------------------------------------------------------------------------------
+
+    class db_binlog_files
+    {
+    public:
+        static std::string segmentPath(const std::string &pathPrefix, uint32_t segment);
+        static inline std::string controlPath(const std::string &pathPrefix)  { return pathPrefix + ".sdbc"; }
+
+        static bool readControl(const std::string &pathPrefix, binlog_control &control);    // false if there is none
+        static void removeSegments(const std::string &pathPrefix, uint32_t firstSegment, uint32_t endSegment);
     };
 
     //----------------------------------------------------------------------------------------------------------------------
@@ -71,23 +152,74 @@ namespace sfera_db
 
     class db_binlog_logger
     {
+    public:
+        struct commit_statistics_t
+        {
+            size_t commits = 0;
+            size_t syncs   = 0;
+            size_t writes  = 0;    // each of the records buffered meanwhile
+            uint64_t commitMicroseconds    = 0;    // from logging an operation until it is synced (written for none)
+            uint64_t maxCommitMicroseconds = 0;
+        };
+
     private:
-        raw_file *_file = nullptr;
+        std::string _pathPrefix;
+        binlog_config _config;
+
+        raw_file *_file = nullptr;    // the current segment
+        raw_file *_controlFile = nullptr;
+        binlog_control _control;
+        uint64_t  _segmentOffset = 0;
         uint64_t  _currentLSN = 0;
+        uint64_t  _logSize = 0;       // written since opened
+
+        std::deque<std::pair<uint32_t, uint64_t>> _segments;    // the live segments of this session and their first lsn
+        uint32_t _firstLiveSegment = 0;    // the segments of the previous sessions are live from this one
+        uint32_t _lastRecordSegment = 0;
+        uint64_t _lastRecordOffset = 0;
+
+        // the current segment, the buffer and the sync state are shared with the commit thread and the pages writers
+        mutable std::mutex _syncMutex;
+        std::condition_variable _ioFinished;
+        std::condition_variable _commitWakeUp;
+        std::thread _commitThread;
+        bool _commitThreadWorking = false;
+        bool _ioInProgress = false;
+        binlog_writer _writer;
+        uint64_t _bufferedLsn = 0;    // the records before are in the buffer
+        uint64_t _writtenLsn = 0;     // the records before are in the file
+        uint64_t _durableLsn = 0;     // the records before are synced
+        std::deque<std::pair<uint64_t, std::chrono::steady_clock::time_point>> _unsyncedCommits;    // lsn and log time
+        commit_statistics_t _commitStatistics;
 
     private:
         void _writeNextRecord(binlog_record &rec);
+        void _openNextSegment(uint64_t firstLsn);
+        void _writeControl();
+
+        void _writeThrough(uint64_t lsn, bool sync, std::unique_lock<std::mutex> &lock);    // under the sync lock
+        void _commitsSynced(uint64_t endLsn, std::chrono::steady_clock::time_point syncedAt);    // under the sync lock
+        void _commitThreadRoutine();
+        void _stopCommitThread();
 
     private:
-        db_binlog_logger() { };
+        db_binlog_logger(const std::string &pathPrefix, const binlog_config &config);
 
     public:
         ~db_binlog_logger();
-        static db_binlog_logger *createEmpty(const std::string& path);
-        static db_binlog_logger *openExisting(const std::string& path, const db_binlog_recovery& recoveryTool);
-
-        void logOperation(db_operation *operation);
-        void logCheckpoint();
+        static db_binlog_logger *createEmpty(const std::string &pathPrefix, const binlog_config &config);
+        static db_binlog_logger *openExisting(const std::string &pathPrefix, const binlog_config &config,
+                                              const db_binlog_recovery &recoveryTool);
+
+        uint64_t logOperation(db_operation *operation);    // returns the record lsn when it is durable enough
+        void waitCommitted(uint64_t lsn);    // group commit: returns once the operation record is synced
+        void logCheckpoint(uint64_t oldestNeededLsn);      // the segments not needed anymore are removed
+        void syncRecord(uint64_t lsn);    // returns once the record is on the disk (at once if durability is none)
+
+        inline uint64_t currentLsn() const  { return _currentLSN; }    // of the next record
+        inline uint64_t logSize() const  { return _logSize; }
+        inline log_durability durability() const  { return _config.durability; }
+        commit_statistics_t commitStatistics() const;
     };
 
     //----------------------------------------------------------------------------------------------------------------------
@@ -96,29 +228,48 @@ namespace sfera_db
 
     //----------------------------------------------------------------------------------------------------------------------
 
+    // the log is scanned first keeping only the newest state of each page, the pages are written afterwards
     class db_binlog_recovery
     {
     private:
-        raw_file *_file = nullptr;
+        // the image of a page (with the later changes applied) or the changes to redo over the stable page
+        struct recovered_page
+        {
+            int pageId = -1;
+            db_page *page = nullptr;
+            std::vector<std::pair<uint64_t, std::vector<uint8_t>>> changes;    // the operation id and the page changes
+        };
+
+        static const size_t maxWriteRunPages = 64;
+
+    private:
+        std::string _pathPrefix;
+        binlog_control _control;
         bool _closedProperly = false;
 
         uint64_t _lastLsn = 0;
         uint64_t _lastOpId = 0;
+        uint32_t _lastSegment = 0;    // the new segments have to follow all the existing ones
+
+        std::map<int, recovered_page> _recoveredPages;    // sorted by the id, so by the offset in the storage
 
 
     protected:
-        void _findBackCheckpoint();
-        void _findBackLastValidRecord();
+        uint64_t _readCheckpoint();    // returns the oldest needed lsn
+        void _collectOperation(raw_file *file);
+        void _collectChanges(raw_file *file);
+        size_t _writeRecoveredPages(db_stable_storage_file *stableStorage, size_t threadsCount);    // returns pages fixed
+        size_t _writeRecoveredRun(db_stable_storage_file *stableStorage, recovered_page *const *pages, size_t pagesCount);
 
     public:
-        db_binlog_recovery(const std::string &path);
-        ~db_binlog_recovery();
+        db_binlog_recovery(const std::string &pathPrefix);
 
-        void releaseLog();
-        void doRecovery(db_stable_storage_file *stableStorage);
+        void doRecovery(db_stable_storage_file *stableStorage, size_t threadsCount = 0);    // 0 - a thread per core
 
+        inline const binlog_control &control() const  { return _control; }
         inline uint64_t lastLsn() const     { return _lastLsn; }
         inline uint64_t lastOpId() const    { return _lastOpId; }
+        inline uint32_t lastSegment() const { return _lastSegment; }
         inline bool closedProperly() const  { return _closedProperly; }
     };
 }
@@ -5,6 +5,8 @@
 #include <iostream>
 #include <cassert>
 #include <limits>
+#include <memory>
+#include <algorithm>
 
 //----------------------------------------------------------------------------------------------------------------------
 
@@ -13,7 +15,10 @@ namespace sfera_db
 //----------------------------------------------------------------------------------------------------------------------
 
 const std::string db_data_storage::StableStorageFileName = "data.sdbs";
-const std::string db_data_storage::LogFileName           = "log.sdbl";
+const std::string db_data_storage::LogFilesPrefix        = "log";
+const std::string db_data_storage::ResidentPagesFileName = "cache.sdbw";
+const std::string db_data_storage::DeferredPagesFileName = "rebalance.sdbw";
+const std::string db_data_storage::CacheSizeFileName     = "cache.sdbc";
 
 //----------------------------------------------------------------------------------------------------------------------
 
@@ -21,19 +26,29 @@ auto db_data_storage::openExisting(const std::string &dirPath, const db_data_sto
 -> db_data_storage *
 {
     auto dbDataStorage = new db_data_storage();
+    dbDataStorage->_dirPath = dirPath;
     dbDataStorage->_stableStorageFile = db_stable_storage_file::openExisting(dirPath + "/" + StableStorageFileName);
 
-    db_binlog_recovery binlogRecovery(dirPath + "/" + dbDataStorage->LogFileName);
-    if (!binlogRecovery.closedProperly()) {
+    db_binlog_recovery binlogRecovery(dirPath + "/" + LogFilesPrefix);
+    bool closedProperly = binlogRecovery.closedProperly();
+    if (!closedProperly) {
         std::cerr << "warning: database wasn't closed peoperly last time -> applying recovery ..." << std::endl;
-        binlogRecovery.doRecovery(dbDataStorage->_stableStorageFile);
+        binlogRecovery.doRecovery(dbDataStorage->_stableStorageFile, params.recoveryThreads);
+
+        // the log opened below takes a checkpoint past the replayed records and removes their segments
+        if (params.binlog.durability != log_durability::none) dbDataStorage->_stableStorageFile->sync();
         std::cerr << "recovery completed" << std::endl;
     }
-    binlogRecovery.releaseLog();
 
     dbDataStorage->_lastKnownOpId = binlogRecovery.lastOpId();
-    dbDataStorage->_initializeCache(params.cacheSizeInPages);
-    dbDataStorage->_binlog = db_binlog_logger::openExisting(dirPath + "/" + dbDataStorage->LogFileName, binlogRecovery);
+    pages_cache_config cacheConfig = params.cache;
+    if (cacheConfig.sizePages == 0) cacheConfig.sizePages = dbDataStorage->_loadCacheSize();
+    dbDataStorage->_initializeCache(cacheConfig);
+    dbDataStorage->_preloadResidentPages(params.cachePreload, closedProperly);
+    dbDataStorage->_deferredPages = dbDataStorage->_takePagesList(DeferredPagesFileName, closedProperly);
+    dbDataStorage->_binlog = db_binlog_logger::openExisting(dirPath + "/" + LogFilesPrefix,
+                                                            params.binlog, binlogRecovery);
+    dbDataStorage->_initializeCheckpoints(params.checkpoint);
 
     return dbDataStorage;
 }
@@ -42,11 +57,19 @@ auto db_data_storage::openExisting(const std::string &dirPath, const db_data_sto
 auto db_data_storage::createEmpty(const std::string &dirPath, db_data_storage_config const &config) -> db_data_storage *
 {
     auto dbDataStorage = new db_data_storage();
+    dbDataStorage->_dirPath = dirPath;
+    for (auto &fileName : { ResidentPagesFileName, DeferredPagesFileName }) {
+        if (raw_file::exists(dirPath + "/" + fileName)) raw_file::remove(dirPath + "/" + fileName);
+    }
+
     dbDataStorage->_stableStorageFile = db_stable_storage_file::createEmpty(dirPath + "/" +
                                                                             dbDataStorage->StableStorageFileName,
                                                                             config);
-    dbDataStorage->_initializeCache(config.cacheSizeInPages);
-    dbDataStorage->_binlog = db_binlog_logger::createEmpty(dirPath + "/" + dbDataStorage->LogFileName);
+    dbDataStorage->_initializeCache(config.cache);
+    dbDataStorage->_saveCacheSize();
+    dbDataStorage->_binlog = db_binlog_logger::createEmpty(dirPath + "/" + LogFilesPrefix,
+                                                           config.binlog);
+    dbDataStorage->_initializeCheckpoints(config.checkpoint);
 
     return dbDataStorage;
 }
@@ -54,7 +77,11 @@ auto db_data_storage::createEmpty(const std::string &dirPath, db_data_storage_co
 
 db_data_storage::~db_data_storage()
 {
+    _savePagesList(ResidentPagesFileName, _pagesCache->residentPages());
+    _savePagesList(DeferredPagesFileName, _deferredPages);
+    _saveCacheSize();
     _pagesCache->clearCache();
+    if (_binlog->durability() != log_durability::none) _stableStorageFile->sync();    // before the log is closed
 
     delete _pagesCache;
     delete _stableStorageFile;
@@ -78,18 +105,32 @@ void db_data_storage::writePage(db_page *page)
 
 db_page* db_data_storage::allocatePage(bool isLeaf)
 {
-    db_page *page = _stableStorageFile->allocatePage(isLeaf);
-    _pagesCache->cacheAndPin(page);
-
-    return page;
+    return _pagesCache->createAndPin(_stableStorageFile->allocatePageId(), isLeaf);
 }
 
 
 void db_data_storage::deallocatePage(int pageId)
 {
-    _stableStorageFile->deallocatePage(pageId);
-    if (_currentOperation != nullptr) _currentOperation->invalidatePage(pageId);
-    _pagesCache->invalidateCachedPage(pageId);
+    if (_currentOperation == nullptr) {
+        _stableStorageFile->deallocatePage(pageId);
+        _pagesCache->invalidateCachedPage(pageId);
+        return;
+    }
+
+    // the page may still be pinned by the caller, so it is actually freed when the operation ends
+    db_page *writtenPage = _currentOperation->invalidatePage(pageId);
+    if (writtenPage != nullptr) _pagesCache->unpin(writtenPage);
+    _currentOperation->freesPage(pageId);
+}
+
+
+void db_data_storage::deallocateAllPages()
+{
+    assert( _currentOperation == nullptr );
+
+    _pagesCache->discardAll();
+    _stableStorageFile->deallocateAllPages();
+    checkpoint(true);    // the replay never starts before the pages have been dropped
 }
 
 
@@ -97,14 +138,19 @@ db_page* db_data_storage::fetchPage(int pageId)
 {
     db_page *cachedVersion = _pagesCache->fetchAndPin(pageId);
     if (cachedVersion == nullptr) {
-        cachedVersion = _stableStorageFile->loadPage(pageId);
-        _pagesCache->cacheAndPin(cachedVersion);
+        cachedVersion = _pagesCache->loadAndPin(pageId);
     }
 
     return cachedVersion;
 }
 
 
+db_page* db_data_storage::fetchCachedPage(int pageId)
+{
+    return _pagesCache->fetchAndPin(pageId);
+}
+
+
 void db_data_storage::changeRootPage(int pageId)
 {
     _stableStorageFile->changeRootPage(pageId);
@@ -135,17 +181,113 @@ void db_data_storage::writeAndRelease(db_page *page)
 }
 
 
-void db_data_storage::_initializeCache(size_t sizeInPages)
+void db_data_storage::_initializeCache(const pages_cache_config &config)
 {
-    _pagesCache = new pages_cache(sizeInPages,
-                                 [this](db_page *page) {
-                                     _stableStorageFile->writePage(page);
+    _pagesCache = new pages_cache(config, _stableStorageFile->pageSize(),
+                                 [this](db_page *const *pages, size_t pagesCount) {
+                                     _syncPagesLog(pages, pagesCount);
+                                     _stableStorageFile->writePages(pages, pagesCount);
+                                 },
+                                 [this](int firstPageId, uint8_t *const *pagesBytes, size_t pagesCount) {
+                                     return _stableStorageFile->readPages(firstPageId, pagesBytes, pagesCount);
                                  });
 }
 
 
+void db_data_storage::_syncPagesLog(db_page *const *pages, size_t pagesCount)
+{
+    // write-ahead logging: a page can't reach the disk before the records of its changes
+    uint64_t lastPageLsn = 0;
+    for (size_t i = 0; i < pagesCount; ++i) {
+        lastPageLsn = std::max(lastPageLsn, (uint64_t) pages[i]->cacheRelatedInfo().pageLsn);
+    }
+
+    if (lastPageLsn > 0) _binlog->syncRecord(lastPageLsn);
+}
+
+
+void db_data_storage::_savePagesList(const std::string &fileName, const std::vector<int> &pageIds)
+{
+    // the lists only spare some work after the start, so failing to save one doesn't prevent closing
+    try {
+        std::unique_ptr<raw_file> file(raw_file::createNew(_dirPath + "/" + fileName));
+        uint64_t pagesCount = pageIds.size();
+
+        off_t offset = file->writeAll(0, &pagesCount, sizeof(pagesCount));
+        file->writeAll(offset, pageIds.data(), pageIds.size() * sizeof(int));
+    }
+    catch (const std::exception &err) {
+        std::cerr << "warning: failed to save the " << fileName << " pages list: " << err.what() << std::endl;
+    }
+}
+
+
+std::vector<int> db_data_storage::_takePagesList(const std::string &fileName, bool valid)
+{
+    std::string filePath = _dirPath + "/" + fileName;
+    if (!raw_file::exists(filePath)) return std::vector<int>();
+
+    // the list is valid only for the state of the database it has been saved at
+    std::vector<int> pageIds;
+    if (valid) {
+        std::unique_ptr<raw_file> file(raw_file::openExisting(filePath, true));
+
+        uint64_t pagesCount = 0;
+        if (file->tryReadAll(0, &pagesCount, sizeof(pagesCount)) &&
+            sizeof(pagesCount) + pagesCount * sizeof(int) == file->actualSize()) {
+            pageIds.resize(pagesCount);
+            file->readAll(sizeof(pagesCount), pageIds.data(), pagesCount * sizeof(int));
+        }
+    }
+    raw_file::remove(filePath);
+
+    pageIds.erase(std::remove_if(pageIds.begin(), pageIds.end(), [this](int pageId) {
+        return !_stableStorageFile->pageAllocated(pageId);
+    }), pageIds.end());
+
+    return pageIds;
+}
+
+
+void db_data_storage::_saveCacheSize()
+{
+    try {
+        std::unique_ptr<raw_file> file(raw_file::createNew(_dirPath + "/" + CacheSizeFileName));
+        uint64_t sizePages = _pagesCache->statistics().sizePages;
+        file->writeAll(0, &sizePages, sizeof(sizePages));
+    }
+    catch (const std::exception &err) {
+        std::cerr << "warning: failed to save the cache size: " << err.what() << std::endl;
+    }
+}
+
+
+size_t db_data_storage::_loadCacheSize()
+{
+    std::string filePath = _dirPath + "/" + CacheSizeFileName;
+    uint64_t sizePages = 0;
+
+    // the databases created before the size has been saved get the default one
+    if (raw_file::exists(filePath)) {
+        std::unique_ptr<raw_file> file(raw_file::openExisting(filePath, true));
+        if (!file->tryReadAll(0, &sizePages, sizeof(sizePages))) sizePages = 0;
+    }
+
+    return sizePages != 0 ? (size_t) sizePages : pages_cache_config().sizePages;
+}
+
+
+void db_data_storage::_preloadResidentPages(cache_preload_mode preloadMode, bool closedProperly)
+{
+    std::vector<int> pageIds = _takePagesList(ResidentPagesFileName,
+                                              closedProperly && preloadMode != cache_preload_mode::none);
+    if (!pageIds.empty()) _pagesCache->preload(pageIds, preloadMode == cache_preload_mode::background);
+}
+
+
 void db_data_storage::onOperationStart(db_operation *op)
 {
+    _pagesCache->takeBackOverflowFrames();    // fails the operation before it has changed any page
     _currentOperation = op;
 }
 
@@ -153,15 +295,65 @@ void db_data_storage::onOperationStart(db_operation *op)
 void db_data_storage::onOperationEnd()
 {
     if (!_currentOperation->isReadOnly()) {
-        auto activeWriteSet = _currentOperation->pagesWriteSet();
-        for (auto pageWritten : activeWriteSet) {
-            _pagesCache->unpin(pageWritten.second);
+        auto &activeWriteSet = _currentOperation->pagesWriteSet();
+        uint64_t lsn = activeWriteSet.empty() ? 0 : _binlog->logOperation(_currentOperation);
+        if (lsn != 0) _lastLoggedLsn = lsn;
+
+        // the pages can be written (by the background writer as well) only after they have been logged
+        for (auto &pageWritten : activeWriteSet) {
+            pageWritten.page->wasLogged();
+            _pagesCache->markLogged(pageWritten.page, lsn);
+            _pagesCache->unpin(pageWritten.page);
         }
 
-        _binlog->logOperation(_currentOperation);
+        for (int pageId : _currentOperation->pagesFreed()) {
+            _pagesCache->invalidateCachedPage(pageId);
+            _stableStorageFile->deallocatePage(pageId);
+        }
     }
 
     _currentOperation = nullptr;
+    if (_checkpointDue()) checkpoint(false);
+}
+
+
+void db_data_storage::_initializeCheckpoints(const checkpoint_config &config)
+{
+    _checkpointConfig = config;
+    _lastCheckpointTime = std::chrono::steady_clock::now();
+    _lastCheckpointLogSize = _binlog->logSize();
+}
+
+
+bool db_data_storage::_checkpointDue() const
+{
+    if (_checkpointConfig.logBytes > 0 && _binlog->logSize() - _lastCheckpointLogSize >= _checkpointConfig.logBytes) {
+        return true;
+    }
+
+    return _checkpointConfig.intervalSeconds > 0 &&
+           std::chrono::steady_clock::now() - _lastCheckpointTime >= std::chrono::seconds(_checkpointConfig.intervalSeconds);
+}
+
+
+void db_data_storage::checkpoint(bool sharp)
+{
+    assert( _currentOperation == nullptr );
+
+    if (sharp) _pagesCache->flush();
+
+    // the replay has to start from the first change not written yet
+    uint64_t checkpointLsn = _binlog->currentLsn();
+    uint64_t oldestNeededLsn = _pagesCache->oldestRecoveryLsn();
+    if (_binlog->durability() != log_durability::none) _stableStorageFile->sync();    // the pages written back so far
+    _binlog->logCheckpoint(oldestNeededLsn != 0 ? oldestNeededLsn : checkpointLsn + 1);
+
+    // the pages logged before are written meanwhile, so the next checkpoint can move the replay start up to here
+    if (!sharp) _pagesCache->writeBackLoggedBefore(checkpointLsn);
+
+    _lastCheckpointTime = std::chrono::steady_clock::now();
+    _lastCheckpointLogSize = _binlog->logSize();
+    _checkpointsCount++;
 }
 
 
@@ -8,13 +8,19 @@
 #include "db_stable_storage_file.hpp"
 #include "db_binlog_logger.hpp"
 
+#include <chrono>
+
 //----------------------------------------------------------------------------------------------------------------------
 
 namespace sfera_db
 {
     struct db_data_storage_open_params
     {
-        size_t cacheSizeInPages = 256;
+        pages_cache_config cache;
+        cache_preload_mode cachePreload = cache_preload_mode::none;
+        checkpoint_config checkpoint;
+        binlog_config binlog;
+        size_t recoveryThreads = 0;    // write the recovered pages in parallel (0 - a thread per core)
     };
 
     //----------------------------------------------------------------------------------------------------------------------
@@ -23,20 +29,40 @@ namespace sfera_db
     {
     private:
         static const std::string StableStorageFileName;
-        static const std::string LogFileName;
+        static const std::string LogFilesPrefix;
+        static const std::string ResidentPagesFileName;
+        static const std::string DeferredPagesFileName;
+        static const std::string CacheSizeFileName;
 
 
     private:
+        std::string _dirPath;
         pages_cache *_pagesCache = nullptr;
         db_stable_storage_file *_stableStorageFile = nullptr;
         db_binlog_logger *_binlog = nullptr;
 
         db_operation *_currentOperation = nullptr;
         uint64_t _lastKnownOpId = 0;
+        uint64_t _lastLoggedLsn = 0;
+
+        checkpoint_config _checkpointConfig;
+        std::chrono::steady_clock::time_point _lastCheckpointTime;
+        uint64_t _lastCheckpointLogSize = 0;
+        size_t _checkpointsCount = 0;
+
+        std::vector<int> _deferredPages;    // left underfull by the last session, rebalanced in the next one
 
 
     private:
-        void _initializeCache(size_t sizeInPages);
+        void _initializeCache(const pages_cache_config &config);
+        void _syncPagesLog(db_page *const *pages, size_t pagesCount);
+        void _savePagesList(const std::string &fileName, const std::vector<int> &pageIds);
+        std::vector<int> _takePagesList(const std::string &fileName, bool valid);
+        void _saveCacheSize();
+        size_t _loadCacheSize();
+        void _preloadResidentPages(cache_preload_mode preloadMode, bool closedProperly);
+        void _initializeCheckpoints(const checkpoint_config &config);
+        bool _checkpointDue() const;
 
     private:
         db_data_storage() { }
@@ -49,6 +75,9 @@ namespace sfera_db
         static bool exists(const std::string &path);
 
         db_page* fetchPage(int pageId);
+        db_page* fetchCachedPage(int pageId);    // returns nullptr instead of reading the page
+        inline db_page* fetchChildPage(db_page *parent, int childPosition)  { return _pagesCache->fetchChildAndPin(parent, childPosition); }
+        inline void prefetchPages(const std::vector<int> &pageIds)  { _pagesCache->prefetch(pageIds); }
         db_page* allocatePage(bool isLeaf);
         void releasePage(db_page *page);
 
@@ -57,14 +86,26 @@ namespace sfera_db
 
         void deallocatePage(int pageId);
         void deallocateAndRelease(db_page *page);
+        void deallocateAllPages();
 
         void onOperationStart(db_operation *op);
         void onOperationEnd();
+        inline uint64_t lastLoggedLsn() const  { return _lastLoggedLsn; }
+        inline void waitCommitted(uint64_t lsn)  { if (lsn != 0) _binlog->waitCommitted(lsn); }    // group commit
 
         void changeRootPage(int pageId);
         inline int rootPageId() const  { return _stableStorageFile->rootPageId(); }
 
         inline const pages_cache& pagesCache() const  { return *_pagesCache; }
+        inline void resizeCache(size_t sizePages)  { _pagesCache->resize(sizePages); }
+        void checkpoint(bool sharp);    // between the operations, a sharp one writes all the dirty pages at once
+        inline size_t checkpointsCount() const  { return _checkpointsCount; }
+        inline db_binlog_logger::commit_statistics_t commitStatistics() const  { return _binlog->commitStatistics(); }
+        inline log_durability logDurability() const  { return _binlog->durability(); }
+        inline void setResidentPages(const std::vector<int> &pageIds)  { _pagesCache->setResidentPages(pageIds); }
+        inline std::vector<int> takeDeferredPages()  { return std::move(_deferredPages); }
+        inline void setDeferredPages(std::vector<int> pageIds)  { _deferredPages = std::move(pageIds); }
+        inline size_t pageSize() const  { return _stableStorageFile->pageSize(); }
         inline uint64_t lastKnownOpId() const  { return _lastKnownOpId; }
     };
 
@@ -8,11 +8,77 @@
 
 //----------------------------------------------------------------------------------------------------------------------
 
+enum class pages_replacement_policy
+{
+    lru,
+    clock,
+    two_queue,
+    arc,
+    lru2
+};
+
+
+// when the logged operations reach the disk (none - when the OS writes them)
+enum class log_durability
+{
+    none,
+    async,          // synced in the background every sync interval
+    per_commit,     // synced by each operation
+    group_commit    // each operation waits for its sync, the first waiter syncs the ones logged meanwhile as well
+};
+
+
+enum class cache_preload_mode
+{
+    none,
+    synchronous,    // the database is opened after the pages have been read
+    background
+};
+
+
+struct pages_cache_config
+{
+    size_t sizePages = 256;
+    bool strictSizeLimit = false;       // the next operation throws pages_cache_full while over the size
+    pages_replacement_policy replacementPolicy = pages_replacement_policy::lru;
+    bool hugePages = false;             // advise the kernel to back the cache frames with huge pages
+    size_t shardsCount = 0;             // independently locked parts of the cache (0 - by the cache size)
+
+    size_t writerPagesPerSecond = 0;    // background writer rate (0 - dirty pages are written only on eviction)
+    unsigned writerCleanPercent = 25;   // the writer keeps so many percent of each shard free or clean
+
+    size_t prefetchThreads = 0;         // read pages ahead of use (0 - prefetch requests are ignored)
+    bool swizzling = false;             // cached parents point to their cached children directly
+    size_t compressedTierBytes = 0;     // evicted pages kept compressed in memory (0 - they are read from the disk)
+    size_t flushThreads = 0;            // write the sorted dirty pages in parallel on flush (0 - the flushing thread)
+};
+
+
+// fuzzy checkpoints are taken between the operations, the dirty pages are written back in the background
+struct checkpoint_config
+{
+    size_t intervalSeconds = 0;    // time since the last checkpoint (0 - no time trigger)
+    size_t logBytes = 0;           // log written since the last checkpoint (0 - no log size trigger)
+};
+
+
+struct binlog_config
+{
+    size_t segmentBytes = 16 << 20;    // the log segments older than the checkpoint are removed
+    bool pageChanges = false;          // log the operations made in the pages instead of their images
+    log_durability durability = log_durability::none;
+    size_t syncIntervalMs = 10;            // async: between the background syncs
+    size_t bufferBytes = 256 << 10;        // the records gathered for one write (a longer record grows the buffer)
+};
+
+
 struct db_data_storage_config
 {
     size_t pageSize           = 4096;
     size_t maxStorageSize     = 0;
-    size_t cacheSizeInPages   = 256;
+    pages_cache_config cache;
+    checkpoint_config checkpoint;
+    binlog_config binlog;
 };
 
 //----------------------------------------------------------------------------------------------------------------------
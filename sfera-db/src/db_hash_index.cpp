@@ -0,0 +1,137 @@
+
+#include "db_hash_index.hpp"
+
+#include <algorithm>
+
+//----------------------------------------------------------------------------------------------------------------------
+
+namespace sfera_db
+{
+//----------------------------------------------------------------------------------------------------------------------
+
+db_hash_index::db_hash_index(size_t maxEntries, size_t admissionLookups) :
+    _maxEntries(std::max(maxEntries, (size_t) 1)),
+    _admissionLookups(std::min(std::max(admissionLookups, (size_t) 1), (size_t) UINT8_MAX)),
+    _lookupCounters(_maxEntries * 4, 0)
+{
+    _entries.reserve(_maxEntries);
+}
+
+
+uint64_t db_hash_index::_keyHash(data_blob key)
+{
+    uint64_t hash = 14695981039346656037ULL;    // FNV-1a
+    for (uint8_t *ptr = key.dataPtr(); ptr != key.dataEndPtr(); ++ptr) {
+        hash ^= *ptr;
+        hash *= 1099511628211ULL;
+    }
+
+    hash ^= hash >> 31;    // the low bits pick the lookup counter
+    return hash * 0xBF58476D1CE4E5B9ULL;
+}
+
+
+auto db_hash_index::find(data_blob key) const -> const entry *
+{
+    auto entryIt = _entries.find(_keyHash(key));
+    if (entryIt == _entries.end()) return nullptr;
+
+    entryIt->second.lookups++;
+    return &entryIt->second;
+}
+
+
+void db_hash_index::onLookup(data_blob key, int pageId, int inPagePosition, uint64_t pageVersion)
+{
+    uint64_t keyHash = _keyHash(key);
+
+    auto entryIt = _entries.find(keyHash);
+    if (entryIt != _entries.end()) {    // the entry was stale and the key has been found by the tree descent
+        entryIt->second.pageId = pageId;
+        entryIt->second.inPagePosition = inPagePosition;
+        entryIt->second.pageVersion = pageVersion;
+        return;
+    }
+
+    uint8_t &lookupsCount = _lookupCounters[keyHash % _lookupCounters.size()];
+    if (lookupsCount < UINT8_MAX) lookupsCount++;
+    bool admitted = lookupsCount >= _admissionLookups;
+    if (admitted) lookupsCount = 0;
+
+    if (++_countedLookups >= _lookupCounters.size()) _ageLookupCounters();
+    if (!admitted) return;
+
+    if (_entries.size() >= _maxEntries) _evictColdEntries();
+    _entries.emplace(keyHash, entry(pageId, inPagePosition, pageVersion));
+    _statistics.admissions++;
+}
+
+
+void db_hash_index::_ageLookupCounters()
+{
+    // the keys looked up often recently keep a part of their count, the rare ones are forgotten
+    for (uint8_t &lookupsCount : _lookupCounters) {
+        lookupsCount /= 2;
+    }
+
+    _countedLookups = 0;
+}
+
+
+void db_hash_index::_evictColdEntries()
+{
+    // the least looked up eighth of the entries is evicted at once, the rest keep half of their lookups
+    std::vector<uint32_t> lookups;
+    lookups.reserve(_entries.size());
+    for (auto &indexEntry : _entries) {
+        lookups.push_back(indexEntry.second.lookups);
+    }
+
+    size_t evictedCount = std::max(_entries.size() / 8, (size_t) 1);
+    std::nth_element(lookups.begin(), lookups.begin() + (evictedCount - 1), lookups.end());
+    uint32_t maxEvictedLookups = lookups[evictedCount - 1];
+    size_t evictedWithMax = evictedCount - std::count_if(lookups.begin(), lookups.begin() + evictedCount,
+                                                          [=](uint32_t count) { return count < maxEvictedLookups; });
+
+    for (auto entryIt = _entries.begin(); entryIt != _entries.end(); ) {
+        uint32_t entryLookups = entryIt->second.lookups;
+        bool evicted = entryLookups < maxEvictedLookups || (entryLookups == maxEvictedLookups && evictedWithMax > 0);
+
+        if (evicted) {
+            if (entryLookups == maxEvictedLookups) evictedWithMax--;
+            entryIt = _entries.erase(entryIt);
+        } else {
+            entryIt->second.lookups /= 2;
+            ++entryIt;
+        }
+    }
+}
+
+
+void db_hash_index::onHit()
+{
+    _statistics.hits++;
+}
+
+
+void db_hash_index::onStaleEntry()
+{
+    _statistics.staleEntries++;
+}
+
+
+void db_hash_index::invalidate(data_blob key)
+{
+    _entries.erase(_keyHash(key));
+}
+
+
+void db_hash_index::clear()
+{
+    _entries.clear();
+    std::fill(_lookupCounters.begin(), _lookupCounters.end(), 0);
+    _countedLookups = 0;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+}
@@ -0,0 +1,72 @@
+#ifndef SFERA_DB_DB_HASH_INDEX_HPP
+#define SFERA_DB_DB_HASH_INDEX_HPP
+
+//----------------------------------------------------------------------------------------------------------------------
+
+#include "db_containers.hpp"
+
+#include <unordered_map>
+#include <vector>
+
+//----------------------------------------------------------------------------------------------------------------------
+
+namespace sfera_db
+{
+
+    // the entries are found by the key hash, the key at the entry position is compared by the caller
+    class db_hash_index
+    {
+    public:
+        struct entry
+        {
+            int pageId;
+            int inPagePosition;
+            uint64_t pageVersion;    // the last operation id which modified the page
+            mutable uint32_t lookups = 0;    // halved on each eviction, the least looked up entries are evicted
+
+            entry(int pi, int pos, uint64_t pv) : pageId(pi), inPagePosition(pos), pageVersion(pv)  { }
+        };
+
+
+        struct statistics_t
+        {
+            size_t hits          = 0;
+            size_t staleEntries  = 0;
+            size_t admissions    = 0;
+        };
+
+
+    private:
+        statistics_t _statistics;
+        size_t _maxEntries;
+        size_t _admissionLookups;
+
+        std::unordered_map<uint64_t, entry> _entries;
+        std::vector<uint8_t> _lookupCounters;    // of the keys not admitted yet, shared by the keys with the same hash
+        size_t _countedLookups = 0;              // since the counters were halved
+
+    private:
+        static uint64_t _keyHash(data_blob key);
+        void _evictColdEntries();
+        void _ageLookupCounters();
+
+
+    public:
+        db_hash_index(size_t maxEntries, size_t admissionLookups);
+
+        const entry* find(data_blob key) const;
+        void onLookup(data_blob key, int pageId, int inPagePosition, uint64_t pageVersion);
+        void onHit();
+        void onStaleEntry();
+        void invalidate(data_blob key);
+        void clear();
+
+        inline size_t size() const  { return _entries.size(); }
+        inline const statistics_t &statistics() const  { return _statistics; }
+    };
+
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+#endif //SFERA_DB_DB_HASH_INDEX_HPP
@@ -0,0 +1,117 @@
+
+#include "db_key_filter.hpp"
+
+#include <cmath>
+#include <algorithm>
+
+//----------------------------------------------------------------------------------------------------------------------
+
+namespace sfera_db
+{
+//----------------------------------------------------------------------------------------------------------------------
+
+db_key_filter::db_key_filter(size_t sizeBytes, unsigned hashesCount) :
+    _counters(std::max(sizeBytes, (size_t) 1), 0),
+    _hashesCount(hashesCount)
+{
+    _countersCount = _counters.size() * 2;
+}
+
+
+void db_key_filter::_hashes(data_blob key, uint64_t &h1, uint64_t &h2) const
+{
+    uint64_t hash = 14695981039346656037ULL;    // FNV-1a
+    for (uint8_t *ptr = key.dataPtr(); ptr != key.dataEndPtr(); ++ptr) {
+        hash ^= *ptr;
+        hash *= 1099511628211ULL;
+    }
+
+    uint64_t mixed = hash + 0x9E3779B97F4A7C15ULL;    // splitmix64 finalizer gives the second hash
+    mixed = (mixed ^ (mixed >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    mixed = (mixed ^ (mixed >> 27)) * 0x94D049BB133111EBULL;
+    mixed ^= mixed >> 31;
+
+    h1 = hash;
+    h2 = mixed | 1;
+}
+
+
+void db_key_filter::add(data_blob key)
+{
+    uint64_t h1 = 0, h2 = 0;
+    _hashes(key, h1, h2);
+
+    for (unsigned i = 0; i < _hashesCount; ++i) {
+        size_t index = (size_t) ((h1 + i * h2) % _countersCount);
+        uint8_t counter = _counter(index);
+        if (counter < maxCounterValue) _setCounter(index, (uint8_t) (counter + 1));
+    }
+
+    _keysCount++;
+}
+
+
+void db_key_filter::remove(data_blob key)
+{
+    uint64_t h1 = 0, h2 = 0;
+    _hashes(key, h1, h2);
+
+    for (unsigned i = 0; i < _hashesCount; ++i) {
+        size_t index = (size_t) ((h1 + i * h2) % _countersCount);
+        uint8_t counter = _counter(index);
+        if (counter > 0 && counter < maxCounterValue) _setCounter(index, (uint8_t) (counter - 1));
+    }
+
+    if (_keysCount > 0) _keysCount--;
+}
+
+
+bool db_key_filter::mayContain(data_blob key) const
+{
+    uint64_t h1 = 0, h2 = 0;
+    _hashes(key, h1, h2);
+
+    for (unsigned i = 0; i < _hashesCount; ++i) {
+        if (_counter((size_t) ((h1 + i * h2) % _countersCount)) == 0) return false;
+    }
+
+    return true;
+}
+
+
+void db_key_filter::clear()
+{
+    std::fill(_counters.begin(), _counters.end(), 0);
+    _keysCount = 0;
+}
+
+
+void db_key_filter::onFilteredLookup()
+{
+    _statistics.filteredLookups++;
+}
+
+
+void db_key_filter::onFalsePositive()
+{
+    _statistics.falsePositives++;
+}
+
+
+double db_key_filter::expectedFalsePositiveRate() const
+{
+    double k = _hashesCount;
+    return std::pow(1.0 - std::exp(-k * _keysCount / _countersCount), k);
+}
+
+
+double db_key_filter::observedFalsePositiveRate() const
+{
+    size_t negativeLookups = _statistics.filteredLookups + _statistics.falsePositives;
+    if (negativeLookups == 0) return 0;
+
+    return double(_statistics.falsePositives) / negativeLookups;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+}
@@ -0,0 +1,71 @@
+#ifndef SFERA_DB_DB_KEY_FILTER_HPP
+#define SFERA_DB_DB_KEY_FILTER_HPP
+
+//----------------------------------------------------------------------------------------------------------------------
+
+#include "db_containers.hpp"
+
+#include <vector>
+
+//----------------------------------------------------------------------------------------------------------------------
+
+namespace sfera_db
+{
+
+    // counting bloom filter with 4-bit counters over the live keys (counters that reached the maximum stay there)
+    class db_key_filter
+    {
+    public:
+        struct statistics_t
+        {
+            size_t filteredLookups = 0;    // lookups answered 'not found' without touching pages
+            size_t falsePositives  = 0;
+        };
+
+
+    private:
+        static const uint8_t maxCounterValue = 0x0F;
+
+        statistics_t _statistics;
+        std::vector<uint8_t> _counters;
+        size_t _countersCount = 0;
+        unsigned _hashesCount = 0;
+        size_t _keysCount = 0;
+
+
+    private:
+        inline uint8_t _counter(size_t index) const {
+            return (uint8_t) ((_counters[index / 2] >> ((index % 2) * 4)) & maxCounterValue);
+        }
+
+        inline void _setCounter(size_t index, uint8_t value) {
+            unsigned shift = (unsigned) (index % 2) * 4;
+            _counters[index / 2] = (uint8_t) ((_counters[index / 2] & ~(maxCounterValue << shift)) | (value << shift));
+        }
+
+        void _hashes(data_blob key, uint64_t &h1, uint64_t &h2) const;
+
+    public:
+        db_key_filter(size_t sizeBytes, unsigned hashesCount);
+
+        void add(data_blob key);
+        void remove(data_blob key);
+        bool mayContain(data_blob key) const;
+        void clear();
+
+        void onFilteredLookup();
+        void onFalsePositive();
+
+        double expectedFalsePositiveRate() const;
+        double observedFalsePositiveRate() const;
+
+        inline size_t memoryBytes() const  { return _counters.size(); }
+        inline size_t keysCount() const  { return _keysCount; }
+        inline const statistics_t &statistics() const  { return _statistics; }
+    };
+
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+#endif //SFERA_DB_DB_KEY_FILTER_HPP
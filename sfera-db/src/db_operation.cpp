@@ -10,29 +10,34 @@ namespace sfera_db
 
 bool db_operation::writesPage(db_page *page)
 {
-    auto pageIt = _pagesWriteSet.find(page->id());
-    if (pageIt == _pagesWriteSet.end()) {
-        _pagesWriteSet.insert(std::make_pair(page->id(), page));
+    db_page *writtenPage = _pagesWriteSet.find(page->id());
+    if (writtenPage == nullptr) {
+        _pagesWriteSet.insert(page->id(), page);
         return false;
     }
 
-    assert( pageIt->second == page );
+    assert( writtenPage == page );
     return true;
 }
 
 
-void db_operation::invalidatePage(int pageId)
+db_page* db_operation::invalidatePage(int pageId)
 {
-    //auto pageIt = _pagesWriteSet.find(pageId);
-    //if (pageIt == _pagesWriteSet.end()) return;
+    db_page *page = _pagesWriteSet.find(pageId);
+    if (page != nullptr) _pagesWriteSet.erase(pageId);
+    return page;
+}
+
 
-    _pagesWriteSet.erase(pageId);
+void db_operation::freesPage(int pageId)
+{
+    _pagesFreed.push_back(pageId);
 }
 
 
 bool db_operation::isReadOnly()
 {
-    return _pagesWriteSet.empty();
+    return _pagesWriteSet.empty() && _pagesFreed.empty();
 }
 
 //----------------------------------------------------------------------------------------------------------------------
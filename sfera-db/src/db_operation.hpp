@@ -5,9 +5,10 @@
 //----------------------------------------------------------------------------------------------------------------------
 
 #include <stdint.h>
-#include <unordered_map>
+#include <vector>
 
 #include "db_page.hpp"
+#include "page_table.hpp"
 
 //----------------------------------------------------------------------------------------------------------------------
 
@@ -18,18 +19,21 @@ namespace sfera_db
     {
     private:
         uint64_t _id;
-        std::unordered_map<int, db_page*> _pagesWriteSet;
+        page_table _pagesWriteSet;
+        std::vector<int> _pagesFreed;
 
     public:
         db_operation(uint64_t id) : _id(id) { }
 
         bool writesPage(db_page *page);    // returns true if page already exists in the writeSet
-        void invalidatePage(int pageId);
+        db_page* invalidatePage(int pageId);    // returns the page if it was in the write set
+        void freesPage(int pageId);
 
         bool isReadOnly();
 
         inline uint64_t id() const  { return _id; }
-        inline const std::unordered_map<int, db_page*>& pagesWriteSet()  { return _pagesWriteSet; }
+        inline const page_table& pagesWriteSet()  { return _pagesWriteSet; }
+        inline const std::vector<int>& pagesFreed() const  { return _pagesFreed; }
     };
 
 }
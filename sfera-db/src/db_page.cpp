@@ -24,6 +24,8 @@
 
 #include <cassert>
 #include <algorithm>
+#include <new>
+#include <cstring>
 #include <stdlib.h>
 
 //----------------------------------------------------------------------------------------------------------------------
@@ -135,6 +137,26 @@ db_page* db_page::createEmpty(int index, data_blob pageBytes, bool isLeaf)
 }
 
 
+db_page* db_page::load(int index, data_blob pageBytes, void *descriptor)
+{
+    auto dbPage = new (descriptor) db_page(index, pageBytes);
+    dbPage->_ownsPageBytes = false;
+    dbPage->_load();
+    return dbPage;
+}
+
+
+db_page* db_page::createEmpty(int index, data_blob pageBytes, bool isLeaf, void *descriptor)
+{
+    std::fill(pageBytes.dataPtr(), pageBytes.dataEndPtr(), 0);
+
+    auto dbPage = new (descriptor) db_page(index, pageBytes);
+    dbPage->_ownsPageBytes = false;
+    dbPage->_initializeEmpty(!isLeaf);
+    return dbPage;
+}
+
+
 db_page::db_page(int index, data_blob pageBytes) :
     _index(index),
     _pageSize(pageBytes.length()),
@@ -150,12 +172,19 @@ void db_page::_initializeEmpty(bool hasLinks)
     _recordIndexSize = _calcRecordIndexSize();
     _wasChanged = true;
 
-    //_pageBytesUint64(sizeof(uint64_t), 0);                      // last modified operation id
-    //_pageBytesUint16(sizeof(uint64_t), 0);                      // record count
+    // the redone initialization reuses the object of a page with records
+    _lastModifiedOpId = 0;
+    _recordCount = 0;
+    _pageBytesUint64(0, 0);                                     // last modified operation id
+    _pageBytesUint16(sizeof(uint64_t), 0);                      // record count
 
     _dataBlockEndOffset = _pageSize;
     //_pageBytesUint16(0, (uint16_t) _dataBlockEndOffset);    // data block end offset
     _pageBytes[2*sizeof(uint16_t) + sizeof(uint64_t)] = (uint8_t) hasLinks;
+
+    _changes.clear();    // the page is created over the bytes of a freed one or zeros
+    uint8_t links = (uint8_t) hasLinks;
+    _recordChange(CHANGE_INIT, { {&links, sizeof(links)} });
 }
 
 
@@ -222,6 +251,15 @@ void db_page::insert(int position, key_value data, int linked)
 
     _insertRecordIndex(position, record_index(_dataBlockEndOffset, data.key.length(), data.value.length()), linked);
     _wasChanged = true;
+
+    uint16_t insertPosition = (uint16_t) position;
+    uint16_t keyLength = (uint16_t) data.key.length();
+    uint16_t valueLength = (uint16_t) data.value.length();
+    int32_t child = linked;
+    _recordChange(CHANGE_INSERT, { {&insertPosition, sizeof(insertPosition)}, {&keyLength, sizeof(keyLength)},
+                                   {&valueLength, sizeof(valueLength)}, {&child, sizeof(child)},
+                                   {data.key.dataPtr(), data.key.length()},
+                                   {data.value.dataPtr(), data.value.length()} });
 }
 
 
@@ -259,7 +297,7 @@ void db_page::_insertRecordIndex(int position, db_page::record_index const &reco
     rawPtr[0] = recordIndex.keyValueOffset;
     rawPtr[1] = recordIndex.keyLength;
     rawPtr[2] = recordIndex.valueLength;
-    if (_hasChildren) reconnect(position, linked);
+    if (_hasChildren) _setChild(position, linked);
 
     _recordCount++;
 }
@@ -314,12 +352,22 @@ void db_page::reconnect(int position, int childId)
         if (_hasLinks && childAt(i) == childId) assert(0);
 */
 
+    _setChild(position, childId);
+    _wasChanged = true;
+
+    uint16_t childPosition = (uint16_t) position;
+    int32_t child = childId;
+    _recordChange(CHANGE_RECONNECT, { {&childPosition, sizeof(childPosition)}, {&child, sizeof(child)} });
+}
+
+
+void db_page::_setChild(int position, int childId)
+{
     assert( _pageBytes != nullptr );
     assert(_hasChildren);
     assert( position >= 0 && position <= _recordCount );
 
     *(int32_t *)(_recordIndexRawPtr(position) + 3) = childId;
-    _wasChanged = true;
 }
 
 
@@ -353,6 +401,9 @@ void db_page::remove(int position)
 
     _dataBlockEndOffset += indexBlock.length();
     _wasChanged = true;
+
+    uint16_t removePosition = (uint16_t) position;
+    _recordChange(CHANGE_REMOVE, { {&removePosition, sizeof(removePosition)} });
 }
 
 
@@ -402,6 +453,7 @@ key_value_copy db_page::splitEquispace(db_page *rightPage)
     // then replace *this* page with proxy page's content (dirty enoughf)
     // this is done because insertion in page is much faster than removing now
     db_page *leftProxyPage = new db_page(_index, data_blob((uint8_t *)::calloc(_pageSize, 1), _pageSize));
+    leftProxyPage->_recordingChanges = false;    // this page gets its content as a whole
     leftProxyPage->_initializeEmpty(_hasChildren);
 
     size_t allocatedSpace = (_pageSize - _dataBlockEndOffset);
@@ -477,21 +529,92 @@ key_value db_page::recordAt(int position) const
 
 void db_page::_destructThis()
 {
-    if (_pageBytes) {
+    if (_pageBytes && _ownsPageBytes) {
         free(_pageBytes);
-        _pageBytes = nullptr;
     }
+    _pageBytes = nullptr;
 }
 
 
 void db_page::moveContentFrom(db_page *srcPage)
 {
+    assert( srcPage->_pageSize == _pageSize );
+
     srcPage->prepareForWriting();
-    _pageBytes = srcPage->_pageBytes;
-    srcPage->_pageBytes = nullptr;     // to avoid free in srcPage's destructor
+    std::copy(srcPage->_pageBytes, srcPage->_pageBytes + _pageSize, _pageBytes);    // the bytes may be a cache frame
 
     this->_load();                     // update cached members from _pageBytes
     _wasChanged = srcPage->_wasChanged;
+
+    _changes.clear();    // the page is replaced as a whole
+    _recordChange(CHANGE_IMAGE, { {_pageBytes, _pageSize} });
+}
+
+
+void db_page::_recordChange(change_t change, std::initializer_list<std::pair<const void *, size_t>> fields)
+{
+    if (!_recordingChanges) return;
+
+    _changes.push_back(change);
+    for (auto &field : fields) {
+        _changes.insert(_changes.end(), (const uint8_t *) field.first, (const uint8_t *) field.first + field.second);
+    }
+}
+
+
+void db_page::redoChanges(const uint8_t *changes, size_t length)
+{
+    const uint8_t *reader = changes;
+    auto read = [&reader](void *field, size_t size) {
+        memcpy(field, reader, size);
+        reader += size;
+    };
+
+    _recordingChanges = false;
+    while (reader < changes + length) {
+        change_t change = (change_t) *reader++;
+        uint16_t position = 0;
+        int32_t child = -1;
+
+        switch (change) {
+            case CHANGE_INIT: {
+                uint8_t links = 0;
+                read(&links, sizeof(links));
+                std::fill(_pageBytes, _pageBytes + _pageSize, 0);
+                _initializeEmpty(links != 0);
+                break;
+            }
+            case CHANGE_IMAGE:
+                read(_pageBytes, _pageSize);
+                _load();
+                break;
+
+            case CHANGE_INSERT: {
+                uint16_t keyLength = 0, valueLength = 0;
+                read(&position, sizeof(position));
+                read(&keyLength, sizeof(keyLength));
+                read(&valueLength, sizeof(valueLength));
+                read(&child, sizeof(child));
+
+                data_blob key((uint8_t *) reader, keyLength);
+                data_blob value((uint8_t *) reader + keyLength, valueLength);
+                reader += keyLength + valueLength;
+                insert(position, key_value(key, value), child);
+                break;
+            }
+            case CHANGE_REMOVE:
+                read(&position, sizeof(position));
+                remove(position);
+                break;
+
+            case CHANGE_RECONNECT:
+                read(&position, sizeof(position));
+                read(&child, sizeof(child));
+                reconnect(position, child);
+                break;
+        }
+    }
+    _recordingChanges = true;
 }
 
 
@@ -6,6 +6,8 @@
 
 #include <type_traits>
 #include <iterator>
+#include <vector>
+#include <initializer_list>
 
 #include "db_containers.hpp"
 #include "cached_page_info.hpp"
@@ -65,6 +67,9 @@ namespace sfera_db
 
 
     private:
+        // the changes are recorded as the page operations to be redone over the page in the state before them
+        enum change_t : uint8_t { CHANGE_INIT, CHANGE_IMAGE, CHANGE_INSERT, CHANGE_REMOVE, CHANGE_RECONNECT };
+
         static const int minimallyFullPercent = 47;
         static const int maximallyFullPercent = 70;
 
@@ -73,6 +78,7 @@ namespace sfera_db
         int  _index;
         mutable size_t  _pageSize = 0;
         uint8_t  *_pageBytes = nullptr;
+        bool  _ownsPageBytes = true;    // otherwise the bytes are a frame of the pages cache
         bool  _wasChanged = false;
 
         uint8_t  *_indexTable         = nullptr;
@@ -82,6 +88,9 @@ namespace sfera_db
         off_t     _dataBlockEndOffset = 0;
         bool      _hasChildren        = false;
 
+        std::vector<uint8_t> _changes;    // since the page was logged last time
+        bool _recordingChanges = true;
+
         mutable pages_cache_internals::cached_page_info _cacheRelatedInfo;
 
 
@@ -123,6 +132,8 @@ namespace sfera_db
         record_index _recordIndex(int position) const;
         void _insertRecordIndex(int position, const record_index& recordIndex, int linked);
         void _destructThis();
+        void _setChild(int position, int childId);
+        void _recordChange(change_t change, std::initializer_list<std::pair<const void *, size_t>> fields);
 
     private:
         db_page(int index, data_blob pageBytes);
@@ -135,6 +146,10 @@ namespace sfera_db
         static db_page* load(int index, data_blob pageBytes);
         static db_page* createEmpty(int index, data_blob pageBytes, bool isLeaf);
 
+        // construct the page in the given descriptor memory over bytes the page doesn't own
+        static db_page* load(int index, data_blob pageBytes, void *descriptor);
+        static db_page* createEmpty(int index, data_blob pageBytes, bool isLeaf, void *descriptor);
+
         void moveContentFrom(db_page* srcPage);
         void prepareForWriting();
 
@@ -179,6 +194,10 @@ namespace sfera_db
         }
 
         void wasSaved(uint64_t opId);
+
+        inline const std::vector<uint8_t> &changes() const  { return _changes; }
+        inline void wasLogged()  { _changes.clear(); }
+        void redoChanges(const uint8_t *changes, size_t length);    // the changes recorded by another page instance
     };
 
 }
@@ -0,0 +1,135 @@
+
+#include "db_record_cache.hpp"
+
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+
+//----------------------------------------------------------------------------------------------------------------------
+
+namespace sfera_db
+{
+//----------------------------------------------------------------------------------------------------------------------
+
+db_record_cache::db_record_cache(size_t sizeBytes, size_t slotSize) :
+    _slotSize(slotSize),
+    _slotsCount(slotSize > 0 ? sizeBytes / slotSize : 0)
+{
+    if (_slotsCount == 0) {
+        throw std::runtime_error("record cache size is less than a single record");
+    }
+
+    _arena = (uint8_t *) ::malloc(_slotsCount * _slotSize);
+    if (_arena == nullptr) throw std::bad_alloc();
+
+    _slots.resize(_slotsCount);
+    _slotsByKey.reserve(_slotsCount);
+}
+
+
+db_record_cache::~db_record_cache()
+{
+    ::free(_arena);
+}
+
+
+data_blob_copy db_record_cache::find(data_blob key)
+{
+    auto slotIt = _slotsByKey.find(std::string((const char *) key.dataPtr(), key.length()));
+    if (slotIt == _slotsByKey.end()) {
+        _statistics.misses++;
+        return data_blob_copy();
+    }
+
+    slot_info &slot = _slots[slotIt->second];
+    slot.referenced = true;
+    _statistics.hits++;
+
+    return data_blob_copy(data_blob(_slotBytes(slotIt->second) + slot.keyLength, slot.valueLength));
+}
+
+
+void db_record_cache::admit(data_blob key, data_blob value)
+{
+    if (key.length() + value.length() > _slotSize) {
+        _statistics.rejected++;
+        return;
+    }
+
+    std::string keyStr((const char *) key.dataPtr(), key.length());
+    auto slotIt = _slotsByKey.find(keyStr);
+
+    size_t slot = 0;
+    if (slotIt != _slotsByKey.end()) {
+        slot = slotIt->second;
+    } else {
+        slot = _findVictimSlot();
+        _slotsByKey.emplace(keyStr, slot);
+    }
+
+    uint8_t *slotBytes = _slotBytes(slot);
+    memcpy(slotBytes, key.dataPtr(), key.length());
+    memcpy(slotBytes + key.length(), value.dataPtr(), value.length());
+
+    slot_info &info = _slots[slot];
+    info.keyLength = (uint32_t) key.length();
+    info.valueLength = (uint32_t) value.length();
+    info.used = true;
+    info.referenced = false;    // the first access only admits the record, the next one will protect it
+}
+
+
+size_t db_record_cache::_findVictimSlot()
+{
+    // the hand clears reference bits until it meets a free or an unreferenced slot (at most two turns)
+    while (true) {
+        size_t slot = _clockHand;
+        _clockHand = (_clockHand + 1) % _slotsCount;
+
+        slot_info &info = _slots[slot];
+        if (!info.used) return slot;
+
+        if (info.referenced) {
+            info.referenced = false;
+            continue;
+        }
+
+        _freeSlot(slot);
+        _statistics.evictions++;
+        return slot;
+    }
+}
+
+
+void db_record_cache::_freeSlot(size_t slot)
+{
+    slot_info &info = _slots[slot];
+    assert( info.used );
+
+    _slotsByKey.erase(std::string((const char *) _slotBytes(slot), info.keyLength));
+    info = slot_info();
+}
+
+
+void db_record_cache::invalidate(data_blob key)
+{
+    auto slotIt = _slotsByKey.find(std::string((const char *) key.dataPtr(), key.length()));
+    if (slotIt == _slotsByKey.end()) return;
+
+    size_t slot = slotIt->second;
+    _slotsByKey.erase(slotIt);
+    _slots[slot] = slot_info();
+}
+
+
+void db_record_cache::clear()
+{
+    _slotsByKey.clear();
+    std::fill(_slots.begin(), _slots.end(), slot_info());
+    _clockHand = 0;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+}
@@ -0,0 +1,73 @@
+#ifndef SFERA_DB_DB_RECORD_CACHE_HPP
+#define SFERA_DB_DB_RECORD_CACHE_HPP
+
+//----------------------------------------------------------------------------------------------------------------------
+
+#include "db_containers.hpp"
+
+#include <unordered_map>
+#include <vector>
+
+//----------------------------------------------------------------------------------------------------------------------
+
+namespace sfera_db
+{
+
+    // copies of hot values kept in a fixed arena of equally sized slots, evicted with the CLOCK algorithm
+    class db_record_cache
+    {
+    public:
+        struct statistics_t
+        {
+            size_t hits      = 0;
+            size_t misses    = 0;
+            size_t evictions = 0;
+            size_t rejected  = 0;    // records too large for a slot
+        };
+
+
+    private:
+        struct slot_info
+        {
+            uint32_t keyLength   = 0;
+            uint32_t valueLength = 0;
+            bool     used        = false;
+            bool     referenced  = false;
+        };
+
+
+    private:
+        statistics_t _statistics;
+        size_t _slotSize = 0;
+        size_t _slotsCount = 0;
+        size_t _clockHand = 0;
+
+        uint8_t *_arena = nullptr;
+        std::vector<slot_info> _slots;
+        std::unordered_map<std::string, size_t> _slotsByKey;
+
+    private:
+        inline uint8_t *_slotBytes(size_t slot) const  { return _arena + slot * _slotSize; }
+
+        size_t _findVictimSlot();
+        void _freeSlot(size_t slot);
+
+    public:
+        db_record_cache(size_t sizeBytes, size_t slotSize);
+        ~db_record_cache();
+
+        data_blob_copy find(data_blob key);
+        void admit(data_blob key, data_blob value);
+        void invalidate(data_blob key);
+        void clear();
+
+        inline size_t size() const  { return _slotsByKey.size(); }
+        inline size_t memoryBytes() const  { return _slotsCount * _slotSize; }
+        inline const statistics_t &statistics() const  { return _statistics; }
+    };
+
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+#endif //SFERA_DB_DB_RECORD_CACHE_HPP
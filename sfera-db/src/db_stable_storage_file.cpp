@@ -3,8 +3,10 @@
 
 #include <cassert>
 #include <cstdlib>
+#include <algorithm>
 #include <exception>
 #include <stdexcept>
+#include <vector>
 
 //----------------------------------------------------------------------------------------------------------------------
 
@@ -76,6 +78,7 @@ void db_stable_storage_file::_load()
     _lastFreePage_InfileOffset = offset;
     offset = _file->readAll(offset, &_nextFreePage, sizeof(_nextFreePage));
     _nextFreePage = 0; // todo: according to new ideas in pages allocation this can't be permanently stored
+    _rootPageId_InfileOffset = offset;
     offset = _file->readAll(offset, &_rootPageId,   sizeof(_rootPageId));
 
     _pagesMetaTableStartOffset = offset;
@@ -164,7 +167,23 @@ void db_stable_storage_file::writePage(db_page *page)
 }
 
 
-db_page* db_stable_storage_file::allocatePage(bool isLeaf)
+void db_stable_storage_file::writePages(db_page *const pages[], size_t pagesCount)
+{
+    assert( pagesCount > 0 );
+
+    std::vector<std::pair<const void *, size_t>> buffers;
+    for (size_t i = 0; i < pagesCount; ++i) {
+        assert( pages[i]->id() == pages[0]->id() + (int) i );
+
+        pages[i]->prepareForWriting();
+        buffers.emplace_back(pages[i]->bytes(), pages[i]->size());
+    }
+
+    _file->writeAll(_pageOffset(pages[0]->id()), buffers.data(), buffers.size());
+}
+
+
+int db_stable_storage_file::allocatePageId()
 {
     int pageId = _getNextFreePageIndex();
     _nextFreePage = pageId + 1;
@@ -172,10 +191,7 @@ db_page* db_stable_storage_file::allocatePage(bool isLeaf)
     _updatePageMetaInfo(pageId, true);
     //_file->ensureSizeIsAtLeast(_pageOffset(pageId) + _pageSize);
 
-    uint8_t *rawPageBytes = (uint8_t *)::calloc(_pageSize, 1);
-    db_page *page = db_page::createEmpty(pageId, data_blob(rawPageBytes, _pageSize), isLeaf);
-
-    return page;
+    return pageId;
 }
 
 
@@ -188,14 +204,20 @@ void db_stable_storage_file::deallocatePage(int pageId)
 }
 
 
+void db_stable_storage_file::deallocateAllPages()
+{
+    std::fill(_pagesMetaTable, _pagesMetaTable + _pagesMetaTableSize, 0);
+    _file->writeAll(_pagesMetaTableStartOffset, _pagesMetaTable, _pagesMetaTableSize);
+    _nextFreePage = 0;
+}
+
+
 db_page* db_stable_storage_file::loadPage(int pageId)
 {
     assert( pageId >= 0 && pageId < _maxPageCount );
 
     uint8_t *rawPageBytes = (uint8_t *)::malloc(_pageSize);
-    _file->readAll(_pageOffset(pageId), rawPageBytes, _pageSize);
-
-    if (_file->eof()) {
+    if (!readPage(pageId, rawPageBytes)) {
         ::free(rawPageBytes);
         return nullptr;
     }
@@ -204,6 +226,34 @@ db_page* db_stable_storage_file::loadPage(int pageId)
 }
 
 
+bool db_stable_storage_file::readPage(int pageId, uint8_t *pageBytes)
+{
+    assert( pageId >= 0 && pageId < _maxPageCount );
+
+    return _file->tryReadAll(_pageOffset(pageId), pageBytes, _pageSize);
+}
+
+
+size_t db_stable_storage_file::readPages(int firstPageId, uint8_t *const pagesBytes[], size_t pagesCount)
+{
+    assert( firstPageId >= 0 && firstPageId + pagesCount <= _maxPageCount );
+
+    std::vector<std::pair<void *, size_t>> buffers;
+    for (size_t i = 0; i < pagesCount; ++i) {
+        buffers.emplace_back(pagesBytes[i], _pageSize);
+    }
+
+    return _file->tryReadAll(_pageOffset(firstPageId), buffers.data(), buffers.size()) / _pageSize;
+}
+
+
+bool db_stable_storage_file::pageAllocated(int pageId) const
+{
+    if (pageId < 0 || (size_t) pageId >= _maxPageCount) return false;
+    return (_pagesMetaTable[pageId / 8] & (1 << (pageId % 8))) != 0;
+}
+
+
 void db_stable_storage_file::changeRootPage(int pageId)
 {
     assert( pageId >= 0 && pageId < _maxPageCount );
@@ -53,13 +53,20 @@ namespace sfera_db
         static db_stable_storage_file * createEmpty(std::string const &fileName, db_data_storage_config const &config);
 
         db_page* loadPage(int pageId);
-        db_page* allocatePage(bool isLeaf);
+        bool readPage(int pageId, uint8_t *pageBytes);
+        size_t readPages(int firstPageId, uint8_t *const pagesBytes[], size_t pagesCount);    // returns the pages read
+        bool pageAllocated(int pageId) const;
+        int allocatePageId();
 
         void writePage(db_page *page);
+        void writePages(db_page *const pages[], size_t pagesCount);    // pages with consecutive ids at once
         void deallocatePage(int pageId);
+        void deallocateAllPages();
         void changeRootPage(int pageId);
+        inline void sync()  { _file->sync(); }
 
         inline int rootPageId() const  { return _rootPageId; }
+        inline size_t pageSize() const  { return _pageSize; }
     };
 
 
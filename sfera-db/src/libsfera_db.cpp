@@ -25,7 +25,10 @@ extern "C"
 database* dbopen(const char *file)
 {
 	try {
-		database *db = database::openExisting(file);
+		database_config dbConfig;
+		dbConfig.cacheSizePages = 0;	// the one given to dbcreate or db_set_cache_size
+
+		database *db = database::openExisting(file, dbConfig);
 		return db;
 	}
 	catch_exceptions("dbopen", nullptr);
@@ -73,6 +76,59 @@ int db_delete(database *db, void *key, size_t length)
 }
 
 
+extern "C"
+int db_delete_range(database *db, void *startKey, size_t startKeyLength, void *endKey, size_t endKeyLength)
+{
+	if (db == nullptr || startKey == nullptr || startKeyLength == 0 || endKey == nullptr || endKeyLength == 0)
+		return -1;
+
+	try {
+		db->removeRange(data_blob((uint8_t *)startKey, startKeyLength), data_blob((uint8_t *)endKey, endKeyLength));
+		return 0;
+	}
+	catch_exceptions("db_delete_range", -1);
+}
+
+
+extern "C"
+int db_truncate(database *db)
+{
+	if (db == nullptr)  return -1;
+
+	try {
+		db->truncate();
+		return 0;
+	}
+	catch_exceptions("db_truncate", -1);
+}
+
+
+extern "C"
+int db_compact(database *db)
+{
+	if (db == nullptr)  return -1;
+
+	try {
+		db->compact();
+		return 0;
+	}
+	catch_exceptions("db_compact", -1);
+}
+
+
+extern "C"
+int db_set_cache_size(database *db, size_t cacheSize)
+{
+	if (db == nullptr || cacheSize == 0)  return -1;
+
+	try {
+		db->setCacheSize(cacheSize);
+		return 0;
+	}
+	catch_exceptions("db_set_cache_size", -1);
+}
+
+
 extern "C"
 int db_select(database *db, void *key, size_t keyLength, void **pVal, size_t *pValLength)
 {
@@ -115,6 +171,7 @@ int db_flush(database *db)
 	if (db == nullptr)  return -1;
 
 	try {
+		db->flush();
 		return 0;
 	}
 	catch_exceptions("db_flush", -1);
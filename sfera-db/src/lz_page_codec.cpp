@@ -0,0 +1,166 @@
+
+#include "lz_page_codec.hpp"
+
+#include <cstring>
+#include <algorithm>
+
+//----------------------------------------------------------------------------------------------------------------------
+
+namespace sfera_db
+{
+namespace pages_cache_internals
+{
+//----------------------------------------------------------------------------------------------------------------------
+
+const size_t lz_page_codec::minMatchLength;
+const size_t lz_page_codec::hashBits;
+const size_t lz_page_codec::lastLiteralsLength;
+const size_t lz_page_codec::maxOffset;
+
+
+uint32_t lz_page_codec::_read32(const uint8_t *bytes)
+{
+    uint32_t value;
+    memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+
+
+uint8_t *lz_page_codec::_writeLength(uint8_t *out, const uint8_t *outEnd, size_t length)
+{
+    // the part of a length not fitting the token nibble: 255 for each full byte and the rest
+    for (; length >= 255; length -= 255) {
+        if (out >= outEnd) return nullptr;
+        *out++ = 255;
+    }
+
+    if (out >= outEnd) return nullptr;
+    *out++ = (uint8_t) length;
+    return out;
+}
+
+
+size_t lz_page_codec::compress(const uint8_t *in, size_t length, uint8_t *out, size_t outCapacity)
+{
+    uint32_t positions[1 << hashBits] = {};
+    const uint8_t *outEnd = out + outCapacity;
+    uint8_t *outPtr = out;
+
+    size_t anchor = 0;
+    size_t matchLimit = length > lastLiteralsLength ? length - lastLiteralsLength : 0;
+    size_t position = 0;
+
+    while (true) {
+        // look for the next match
+        size_t candidate = 0;
+        while (position + minMatchLength <= matchLimit) {
+            uint32_t sequence = _read32(in + position);
+            uint32_t &hashPosition = positions[_hash(sequence)];
+            candidate = hashPosition;
+            hashPosition = (uint32_t) position;
+
+            if (candidate < position && position - candidate <= maxOffset && _read32(in + candidate) == sequence) break;
+            position++;
+        }
+
+        bool lastLiterals = position + minMatchLength > matchLimit;
+        size_t literalsLength = (lastLiterals ? length : position) - anchor;
+        size_t matchLength = minMatchLength;
+        if (!lastLiterals) {
+            while (position + matchLength < matchLimit && in[candidate + matchLength] == in[position + matchLength]) {
+                matchLength++;
+            }
+        }
+
+        // token: literals length and match length (less the minimum) nibbles, 15 means the length continues
+        if (outPtr >= outEnd) return 0;
+        uint8_t *token = outPtr++;
+        *token = (uint8_t) (std::min(literalsLength, (size_t) 15) << 4);
+
+        if (literalsLength >= 15) {
+            outPtr = _writeLength(outPtr, outEnd, literalsLength - 15);
+            if (outPtr == nullptr) return 0;
+        }
+
+        if ((size_t) (outEnd - outPtr) < literalsLength) return 0;
+        memcpy(outPtr, in + anchor, literalsLength);
+        outPtr += literalsLength;
+
+        if (lastLiterals) break;
+
+        if (outEnd - outPtr < 2) return 0;
+        size_t offset = position - candidate;
+        *outPtr++ = (uint8_t) (offset & 0xFF);
+        *outPtr++ = (uint8_t) (offset >> 8);
+
+        *token |= (uint8_t) std::min(matchLength - minMatchLength, (size_t) 15);
+        if (matchLength - minMatchLength >= 15) {
+            outPtr = _writeLength(outPtr, outEnd, matchLength - minMatchLength - 15);
+            if (outPtr == nullptr) return 0;
+        }
+
+        position += matchLength;
+        anchor = position;
+    }
+
+    return outPtr - out;
+}
+
+
+bool lz_page_codec::decompress(const uint8_t *in, size_t length, uint8_t *out, size_t outLength)
+{
+    const uint8_t *inEnd = in + length;
+    uint8_t *outPtr = out;
+    uint8_t *outEnd = out + outLength;
+
+    while (in < inEnd) {
+        uint8_t token = *in++;
+
+        size_t literalsLength = token >> 4;
+        if (literalsLength == 15) {
+            uint8_t lengthByte;
+            do {
+                if (in >= inEnd) return false;
+                lengthByte = *in++;
+                literalsLength += lengthByte;
+            } while (lengthByte == 255);
+        }
+
+        if ((size_t) (inEnd - in) < literalsLength || (size_t) (outEnd - outPtr) < literalsLength) return false;
+        memcpy(outPtr, in, literalsLength);
+        in += literalsLength;
+        outPtr += literalsLength;
+
+        if (in == inEnd) break;    // the last sequence has no match
+
+        if (inEnd - in < 2) return false;
+        size_t offset = (size_t) in[0] | ((size_t) in[1] << 8);
+        in += 2;
+        if (offset == 0 || offset > (size_t) (outPtr - out)) return false;
+
+        size_t matchLength = (token & 15) + minMatchLength;
+        if ((token & 15) == 15) {
+            uint8_t lengthByte;
+            do {
+                if (in >= inEnd) return false;
+                lengthByte = *in++;
+                matchLength += lengthByte;
+            } while (lengthByte == 255);
+        }
+
+        if ((size_t) (outEnd - outPtr) < matchLength) return false;
+
+        // byte by byte, the match may overlap the bytes being written
+        const uint8_t *match = outPtr - offset;
+        for (size_t i = 0; i < matchLength; ++i) {
+            outPtr[i] = match[i];
+        }
+        outPtr += matchLength;
+    }
+
+    return outPtr == outEnd;
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+}
+}
@@ -0,0 +1,46 @@
+#ifndef SFERA_DB_LZ_PAGE_CODEC_HPP
+#define SFERA_DB_LZ_PAGE_CODEC_HPP
+
+//----------------------------------------------------------------------------------------------------------------------
+
+#include <cstddef>
+#include <cstdint>
+
+//----------------------------------------------------------------------------------------------------------------------
+
+namespace sfera_db
+{
+    namespace pages_cache_internals
+    {
+
+        // LZ4-like byte oriented block codec: sequences of literals followed by a match within the last 64 KB;
+        // fast enough to be used under the cache shard lock
+        class lz_page_codec
+        {
+        private:
+            static const size_t minMatchLength = 4;
+            static const size_t hashBits = 12;
+            static const size_t lastLiteralsLength = 5;    // a match never reaches the end of the input
+            static const size_t maxOffset = 65535;
+
+        private:
+            static inline uint32_t _read32(const uint8_t *bytes);
+            static inline size_t _hash(uint32_t sequence)  { return (sequence * 2654435761u) >> (32 - hashBits); }
+            static uint8_t *_writeLength(uint8_t *out, const uint8_t *outEnd, size_t length);
+
+        public:
+            static size_t maxCompressedSize(size_t length)  { return length + length / 255 + 16; }
+
+            // returns the compressed length or 0 if the output would be longer than outCapacity
+            static size_t compress(const uint8_t *in, size_t length, uint8_t *out, size_t outCapacity);
+
+            // returns false if the input is corrupted or doesn't decompress to exactly outLength bytes
+            static bool decompress(const uint8_t *in, size_t length, uint8_t *out, size_t outLength);
+        };
+
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+#endif //SFERA_DB_LZ_PAGE_CODEC_HPP
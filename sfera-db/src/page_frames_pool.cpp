@@ -0,0 +1,177 @@
+
+#include "page_frames_pool.hpp"
+#include "syscall_checker.hpp"
+
+#include <cassert>
+#include <cstdlib>
+#include <new>
+#include <algorithm>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+//----------------------------------------------------------------------------------------------------------------------
+
+namespace sfera_db
+{
+namespace pages_cache_internals
+{
+//----------------------------------------------------------------------------------------------------------------------
+
+page_frames_pool::page_frames_pool(size_t framesCount, size_t frameSize, bool hugePages) :
+    _frameSize(frameSize),
+    _hugePages(hugePages),
+    _framesLimit(framesCount)
+{
+    if (framesCount > 0) _mapChunk(framesCount);
+}
+
+
+page_frames_pool::~page_frames_pool()
+{
+    assert( _overflowFramesInUse == 0 );
+
+    for (auto &chunk : _chunks) {
+        ::operator delete(chunk.second.descriptors);
+        ::munmap(chunk.second.bytes, chunk.second.framesCount * _frameSize);
+    }
+}
+
+
+void page_frames_pool::_mapChunk(size_t framesCount)
+{
+    chunk_t chunk;
+    chunk.framesCount = framesCount;
+
+    void *bytes = ::mmap(nullptr, framesCount * _frameSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (bytes == MAP_FAILED) syscall_check(-1);
+    chunk.bytes = (uint8_t *) bytes;
+
+#ifdef MADV_HUGEPAGE
+    if (_hugePages) ::madvise(chunk.bytes, framesCount * _frameSize, MADV_HUGEPAGE);    // only a hint, failures are ignored
+#endif
+
+    chunk.descriptors = (uint8_t *) ::operator new(framesCount * sizeof(db_page));
+    _chunks.emplace(chunk.bytes, chunk);
+
+    for (size_t i = framesCount; i > 0; --i) {
+        _freeFrames.push_back(chunk.bytes + (i - 1) * _frameSize);
+    }
+    _residentFrames += framesCount;
+}
+
+
+auto page_frames_pool::_findChunk(uint8_t *bytes) -> std::map<uint8_t *, chunk_t>::iterator
+{
+    auto chunkIt = _chunks.upper_bound(bytes);
+    if (chunkIt == _chunks.begin()) return _chunks.end();
+
+    --chunkIt;
+    bool inChunk = bytes < chunkIt->second.bytes + chunkIt->second.framesCount * _frameSize;
+    return inChunk ? chunkIt : _chunks.end();
+}
+
+
+auto page_frames_pool::acquire() -> frame
+{
+    if (_freeFrames.empty() && _residentFrames < _framesLimit) {
+        if (!_discardedFrames.empty()) {
+            uint8_t *bytes = _discardedFrames.back();    // pages are faulted in again on the first touch
+            _discardedFrames.pop_back();
+
+            _findChunk(bytes)->second.discardedFrames--;
+            _freeFrames.push_back(bytes);
+            _residentFrames++;
+        } else {
+            _mapChunk(_framesLimit - _residentFrames);
+        }
+    }
+
+    if (_freeFrames.empty()) {
+        _overflowFramesInUse++;
+        return frame { (uint8_t *) ::malloc(_frameSize), ::operator new(sizeof(db_page)) };
+    }
+
+    uint8_t *bytes = _freeFrames.back();
+    _freeFrames.pop_back();
+
+    return frame { bytes, _descriptor(_findChunk(bytes)->second, bytes) };
+}
+
+
+void page_frames_pool::release(frame pageFrame)
+{
+    auto chunkIt = _findChunk(pageFrame.bytes);
+    if (chunkIt == _chunks.end()) {
+        assert( _overflowFramesInUse > 0 );
+        _overflowFramesInUse--;
+
+        ::free(pageFrame.bytes);
+        ::operator delete(pageFrame.descriptor);
+        return;
+    }
+
+    assert( pageFrame.descriptor == _descriptor(chunkIt->second, pageFrame.bytes) );
+    if (_residentFrames > _framesLimit) {
+        _discardFrame(pageFrame.bytes);
+    } else {
+        _freeFrames.push_back(pageFrame.bytes);
+    }
+}
+
+
+void page_frames_pool::release(db_page *page)
+{
+    frame pageFrame { page->bytes(), page };
+    page->~db_page();
+
+    release(pageFrame);
+}
+
+
+void page_frames_pool::_discardFrame(uint8_t *bytes)
+{
+    auto chunkIt = _findChunk(bytes);
+    chunk_t &chunk = chunkIt->second;
+
+    // only the memory pages lying entirely within the frame can be given back (frames may be smaller)
+    uintptr_t osPageSize = (uintptr_t) ::sysconf(_SC_PAGESIZE);
+    uintptr_t discardFrom = ((uintptr_t) bytes + osPageSize - 1) / osPageSize * osPageSize;
+    uintptr_t discardTo = ((uintptr_t) bytes + _frameSize) / osPageSize * osPageSize;
+    if (discardFrom < discardTo) ::madvise((void *) discardFrom, discardTo - discardFrom, MADV_DONTNEED);
+
+    chunk.discardedFrames++;
+    _residentFrames--;
+
+    if (chunk.discardedFrames < chunk.framesCount) {
+        _discardedFrames.push_back(bytes);
+        return;
+    }
+
+    // the whole chunk is unused now
+    uint8_t *chunkEnd = chunk.bytes + chunk.framesCount * _frameSize;
+    _discardedFrames.erase(std::remove_if(_discardedFrames.begin(), _discardedFrames.end(),
+                                          [&](uint8_t *frameBytes) {
+                                              return frameBytes >= chunk.bytes && frameBytes < chunkEnd;
+                                          }), _discardedFrames.end());
+
+    ::operator delete(chunk.descriptors);
+    ::munmap(chunk.bytes, chunk.framesCount * _frameSize);
+    _chunks.erase(chunkIt);
+}
+
+
+void page_frames_pool::setFramesLimit(size_t framesCount)
+{
+    _framesLimit = framesCount;
+
+    while (_residentFrames > _framesLimit && !_freeFrames.empty()) {
+        uint8_t *bytes = _freeFrames.back();
+        _freeFrames.pop_back();
+        _discardFrame(bytes);
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+}
+}
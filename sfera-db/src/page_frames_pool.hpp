@@ -0,0 +1,75 @@
+#ifndef SFERA_DB_PAGE_FRAMES_POOL_HPP
+#define SFERA_DB_PAGE_FRAMES_POOL_HPP
+
+//----------------------------------------------------------------------------------------------------------------------
+
+#include "db_page.hpp"
+
+#include <vector>
+#include <map>
+
+//----------------------------------------------------------------------------------------------------------------------
+
+namespace sfera_db
+{
+    namespace pages_cache_internals
+    {
+
+        // page-sized frames mapped in chunks, each frame coupled with storage for the db_page describing it;
+        // frames are taken from outside the chunks only while the cache can't evict anything (all pinned)
+        class page_frames_pool
+        {
+        public:
+            struct frame
+            {
+                uint8_t *bytes;
+                void *descriptor;
+            };
+
+        private:
+            struct chunk_t
+            {
+                uint8_t *bytes = nullptr;
+                uint8_t *descriptors = nullptr;
+                size_t framesCount = 0;
+                size_t discardedFrames = 0;    // given back to the kernel after the pool has shrunk
+            };
+
+            size_t _frameSize;
+            bool _hugePages;
+            size_t _framesLimit;
+            size_t _residentFrames = 0;    // mapped and not discarded, either free or in use
+
+            std::map<uint8_t *, chunk_t> _chunks;    // by the first frame address
+            std::vector<uint8_t *> _freeFrames;
+            std::vector<uint8_t *> _discardedFrames;
+            size_t _overflowFramesInUse = 0;
+
+        private:
+            std::map<uint8_t *, chunk_t>::iterator _findChunk(uint8_t *bytes);
+            void _mapChunk(size_t framesCount);
+            void _discardFrame(uint8_t *bytes);
+            inline void *_descriptor(const chunk_t &chunk, uint8_t *bytes) const
+                { return chunk.descriptors + (bytes - chunk.bytes) / _frameSize * sizeof(db_page); }
+
+        public:
+            page_frames_pool(size_t framesCount, size_t frameSize, bool hugePages);
+            ~page_frames_pool();
+
+            frame acquire();
+            void release(frame pageFrame);
+            void release(db_page *page);    // destroys the page and returns its frame to the pool
+
+            // frames over the limit are given back to the kernel as soon as they are released
+            void setFramesLimit(size_t framesCount);
+
+            inline size_t overflowFramesInUse() const  { return _overflowFramesInUse; }
+            inline size_t residentBytes() const  { return (_residentFrames + _overflowFramesInUse) * _frameSize; }
+        };
+
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+#endif //SFERA_DB_PAGE_FRAMES_POOL_HPP
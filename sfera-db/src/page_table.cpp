@@ -0,0 +1,128 @@
+
+#include "page_table.hpp"
+
+#include <cassert>
+#include <utility>
+
+//----------------------------------------------------------------------------------------------------------------------
+
+namespace sfera_db
+{
+//----------------------------------------------------------------------------------------------------------------------
+
+const size_t page_table::minCapacity;
+const size_t page_table::maxLoadPercent;
+
+
+page_table::page_table(size_t expectedSize)
+{
+    reserve(expectedSize);
+}
+
+
+db_page* page_table::find(int pageId) const
+{
+    if (_size == 0) return nullptr;
+
+    size_t mask = _slots.size() - 1;
+    size_t slot = _homeSlot(pageId);
+
+    // the entries on the way are ordered by their distance, a closer one means the id is absent
+    for (uint32_t distance = 1;; ++distance, slot = (slot + 1) & mask) {
+        const entry_t &entry = _slots[slot];
+        if (entry.distance < distance) return nullptr;
+        if (entry.pageId == pageId) return entry.page;
+    }
+}
+
+
+bool page_table::insert(int pageId, db_page *page)
+{
+    if (find(pageId) != nullptr) return false;
+
+    if ((_size + 1) * 100 > _slots.size() * maxLoadPercent) _rehash(_slots.size() * 2);
+
+    _place(entry_t { pageId, 1, page });
+    _size++;
+    return true;
+}
+
+
+void page_table::_place(entry_t entry)
+{
+    size_t mask = _slots.size() - 1;
+    size_t slot = _homeSlot(entry.pageId);
+
+    // Robin Hood: the entry takes the place of the first one closer to its home slot, which moves on
+    for (;; ++entry.distance, slot = (slot + 1) & mask) {
+        entry_t &occupant = _slots[slot];
+        if (occupant.distance == 0) {
+            occupant = entry;
+            return;
+        }
+
+        if (occupant.distance < entry.distance) std::swap(occupant, entry);
+    }
+}
+
+
+bool page_table::erase(int pageId)
+{
+    if (_size == 0) return false;
+
+    size_t mask = _slots.size() - 1;
+    size_t slot = _homeSlot(pageId);
+
+    for (uint32_t distance = 1;; ++distance, slot = (slot + 1) & mask) {
+        const entry_t &entry = _slots[slot];
+        if (entry.distance < distance) return false;
+        if (entry.pageId == pageId) break;
+    }
+
+    // the following entries of the cluster are shifted back, so no tombstones are left
+    for (size_t next = (slot + 1) & mask; _slots[next].distance > 1; slot = next, next = (next + 1) & mask) {
+        _slots[slot] = _slots[next];
+        _slots[slot].distance--;
+    }
+
+    _slots[slot] = entry_t();
+    _size--;
+    return true;
+}
+
+
+void page_table::clear()
+{
+    for (auto &entry : _slots) {
+        entry = entry_t();
+    }
+    _size = 0;
+}
+
+
+void page_table::reserve(size_t expectedSize)
+{
+    size_t capacity = minCapacity;
+    while (expectedSize * 100 > capacity * maxLoadPercent) capacity *= 2;
+
+    if (capacity > _slots.size()) _rehash(capacity);
+}
+
+
+void page_table::_rehash(size_t capacity)
+{
+    assert( (capacity & (capacity - 1)) == 0 );
+
+    std::vector<entry_t> oldSlots(capacity, entry_t());
+    oldSlots.swap(_slots);
+
+    _capacityBits = 0;
+    while (((size_t) 1 << _capacityBits) < capacity) _capacityBits++;
+
+    for (auto &entry : oldSlots) {
+        if (entry.distance != 0) _place(entry_t { entry.pageId, 1, entry.page });
+    }
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+}
@@ -0,0 +1,83 @@
+#ifndef SFERA_DB_PAGE_TABLE_HPP
+#define SFERA_DB_PAGE_TABLE_HPP
+
+//----------------------------------------------------------------------------------------------------------------------
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+//----------------------------------------------------------------------------------------------------------------------
+
+namespace sfera_db
+{
+    class db_page;
+
+    // pages by id in one flat array with open addressing (Robin Hood probing, backward shift deletion):
+    // a lookup reads a few adjacent 16-byte slots instead of chasing the nodes of an unordered_map
+    class page_table
+    {
+    public:
+        struct entry_t
+        {
+            int pageId;
+            uint32_t distance;    // from the home slot plus one, 0 - the slot is empty
+            db_page *page;
+        };
+
+
+        class const_iterator
+        {
+        private:
+            const entry_t *_slot;
+            const entry_t *_end;
+
+        public:
+            const_iterator(const entry_t *slot, const entry_t *end) : _slot(slot), _end(end)
+                { while (_slot != _end && _slot->distance == 0) ++_slot; }
+
+            inline const entry_t &operator*() const  { return *_slot; }
+            inline const entry_t *operator->() const  { return _slot; }
+            inline bool operator!=(const const_iterator &other) const  { return _slot != other._slot; }
+            inline const_iterator &operator++()
+                { do ++_slot; while (_slot != _end && _slot->distance == 0); return *this; }
+        };
+
+    private:
+        static const size_t minCapacity = 16;
+        static const size_t maxLoadPercent = 80;
+
+        std::vector<entry_t> _slots;
+        unsigned _capacityBits = 0;
+        size_t _size = 0;
+
+    private:
+        inline size_t _homeSlot(int pageId) const
+            { return (size_t) (((uint64_t) (uint32_t) pageId * 0x9E3779B97F4A7C15ull) >> (64 - _capacityBits)); }
+
+        void _rehash(size_t capacity);
+        void _place(entry_t entry);
+
+    public:
+        explicit page_table(size_t expectedSize = 0);
+
+        db_page* find(int pageId) const;    // nullptr if there is no such page
+        bool insert(int pageId, db_page *page);    // false if the id is already there
+        bool erase(int pageId);
+        void clear();
+        void reserve(size_t expectedSize);
+
+        inline size_t size() const  { return _size; }
+        inline bool empty() const  { return _size == 0; }
+        inline size_t count(int pageId) const  { return find(pageId) != nullptr ? 1 : 0; }
+
+        inline const_iterator begin() const  { return const_iterator(_slots.data(), _slots.data() + _slots.size()); }
+        inline const_iterator end() const
+            { return const_iterator(_slots.data() + _slots.size(), _slots.data() + _slots.size()); }
+    };
+
+}
+
+//----------------------------------------------------------------------------------------------------------------------
+
+#endif //SFERA_DB_PAGE_TABLE_HPP
@@ -1,7 +1,10 @@
-
 #include "pages_cache.hpp"
 #include <cassert>
+#include <stdexcept>
 #include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <exception>
 
 //----------------------------------------------------------------------------------------------------------------------
 
@@ -9,48 +12,173 @@ namespace sfera_db
 {
 //----------------------------------------------------------------------------------------------------------------------
 
-pages_cache::pages_cache(size_t sizePages, std::function<void(db_page*)> pageWriter) :
-    _sizePages(sizePages),
-    _pageWriter(pageWriter)
+const size_t pages_cache::maxAutoShardsCount;
+const size_t pages_cache::minAutoShardSizePages;
+const size_t pages_cache::resizeEvictionsBatch;
+const size_t pages_cache::maxReadAheadRunPages;
+const size_t pages_cache::maxWriteRunPages;
+const size_t pages_cache::swizzlingLatchesCount;
+
+
+pages_cache::shard_t::shard_t(size_t sizePages, size_t pageSize, pages_replacement_policy replacementPolicy,
+                              bool hugePages, size_t compressedTierBytes) :
+    sizePages(sizePages),
+    replacementPolicy(cache_replacement_policy::create(replacementPolicy, sizePages)),
+    framesPool(sizePages, pageSize, hugePages),
+    compressedTier(compressedTierBytes > 0 ? new compressed_pages_tier(compressedTierBytes, pageSize) : nullptr)
+{
+    cachedPages.reserve(sizePages);
+}
+
+
+pages_cache::pages_cache(const pages_cache_config &config, size_t pageSize,
+                         std::function<void(db_page *const *, size_t)> pagesWriter,
+                         std::function<size_t(int, uint8_t *const *, size_t)> pagesReader) :
+    _pagesWriter(pagesWriter),
+    _pagesReader(pagesReader),
+    _pageSize(pageSize),
+    _writerPagesPerSecond(config.writerPagesPerSecond),
+    _writerCleanPercent(config.writerCleanPercent),
+    _residentPages(std::make_shared<const resident_pages_t>()),
+    _swizzling(config.swizzling),
+    _flushThreads(config.flushThreads),
+    _strictSizeLimit(config.strictSizeLimit),
+    _compressedTierBytes(config.compressedTierBytes),
+    _configuredSizePages(std::max(config.sizePages, (size_t) 1))
 {
-    _cachedPages.max_load_factor(1.5);
-    _cachedPages.reserve((size_t)((double)sizePages * 1.5));
+    size_t sizePages = config.sizePages;
+    size_t shardsCount = config.shardsCount;
 
-//    _writerThread = new std::thread([this]() { _writerThreadRoutine(); });
+    if (shardsCount == 0) {
+        shardsCount = std::min(maxAutoShardsCount, sizePages / minAutoShardSizePages);
+    }
+    shardsCount = std::max(std::min(shardsCount, sizePages), (size_t) 1);
+
+    for (size_t i = 0; i < shardsCount; ++i) {
+        size_t shardSizePages = sizePages / shardsCount + (i < sizePages % shardsCount ? 1 : 0);
+        _shards.emplace_back(new shard_t(shardSizePages, pageSize, config.replacementPolicy, config.hugePages,
+                                         _shardCompressedTierBytes(shardSizePages)));
+    }
+
+    if (_writerPagesPerSecond > 0) _startWriterThread();
+
+    if (config.prefetchThreads > 0) {
+        _maxPrefetchQueueLength = std::max(sizePages / 4, (size_t) 1);
+        _prefetchThreadsWorking = true;
+        for (size_t i = 0; i < config.prefetchThreads; ++i) {
+            _prefetchThreads.emplace_back([this]() { _prefetchThreadRoutine(); });
+        }
+    }
 }
 
 
 db_page* pages_cache::fetchAndPin(int pageId)
 {
-    _statistics.fetchesCount++;
+    db_page *residentPage = _findResident(pageId);
+    if (residentPage != nullptr) {
+        pin(residentPage);
+        _residentHits++;
+        return residentPage;
+    }
+
+    shard_t &shard = _shard(pageId);
+    std::unique_lock<std::mutex> lock(shard.mutex);
 
-    auto pageIt = _cachedPages.find(pageId);
-    if (pageIt == _cachedPages.end()) {
-        _statistics.missesCount++;
+    shard.statistics.fetchesCount++;
+    _waitForPageIo(shard, lock, pageId);
+
+    db_page *page = shard.cachedPages.find(pageId);
+    if (page == nullptr) {
+        shard.statistics.missesCount++;
         return nullptr;
     }
 
-    pin(pageIt->second);
-    _lruAccess(pageIt->second);
-    return pageIt->second;
+    pin(page);
+    shard.statistics.queueHits[shard.replacementPolicy->onAccess(page)]++;
+    _onFetched(shard, page);
+    return page;
 }
 
 
-void pages_cache::cacheAndPin(db_page *page)
+db_page* pages_cache::loadAndPin(int pageId)
 {
-    assert( page != nullptr );
-    assert( _cachedPages.find(page->id()) == _cachedPages.end() );
+    db_page *residentPage = _findResident(pageId);
+    if (residentPage != nullptr) {
+        pin(residentPage);
+        return residentPage;
+    }
+
+    shard_t &shard = _shard(pageId);
+    std::unique_lock<std::mutex> lock(shard.mutex);
+    bool missNoted = false;
+
+    while (true) {
+        _waitForPageIo(shard, lock, pageId);
+
+        // another thread could have loaded the page since our miss
+        db_page *cachedPage = shard.cachedPages.find(pageId);
+        if (cachedPage != nullptr) {
+            pin(cachedPage);
+            shard.statistics.queueHits[shard.replacementPolicy->onAccess(cachedPage)]++;
+            _onFetched(shard, cachedPage);
+            return cachedPage;
+        }
+
+        if (!missNoted) shard.replacementPolicy->onMiss(pageId);
+        missNoted = true;
+        if (_makeRoom(shard, lock)) break;
+    }
+
+    auto frame = shard.framesPool.acquire();
+    if (!_takeCompressed(shard, pageId, frame) && _pagesReader(pageId, &frame.bytes, 1) != 1) {
+        shard.framesPool.release(frame);
+        throw std::runtime_error("failed to read page " + std::to_string(pageId));
+    }
+
+    db_page *page = db_page::load(pageId, data_blob(frame.bytes, _pageSize), frame.descriptor);
+    _cacheAndPin(shard, page);
+    return page;
+}
+
+
+db_page* pages_cache::createAndPin(int pageId, bool isLeaf)
+{
+    shard_t &shard = _shard(pageId);
+    std::unique_lock<std::mutex> lock(shard.mutex);
+    shard.replacementPolicy->onMiss(pageId);
+
+    do {
+        _waitForPageIo(shard, lock, pageId);
 
-    _cachedPages.emplace(page->id(), page);
+        // the id could belong to a freed page read by a prefetch request issued before it had been freed
+        db_page *stalePage = shard.cachedPages.find(pageId);
+        if (stalePage != nullptr) {
+            assert( stalePage->cacheRelatedInfo().prefetched && !stalePage->cacheRelatedInfo().isUsed() );
+            shard.replacementPolicy->onRemoved(stalePage, false);
+            _finalizePage(shard, stalePage);
+        }
+    } while (!_makeRoom(shard, lock));
+
+    if (shard.compressedTier != nullptr) shard.compressedTier->invalidate(pageId);
+    auto frame = shard.framesPool.acquire();
+    db_page *page = db_page::createEmpty(pageId, data_blob(frame.bytes, _pageSize), isLeaf, frame.descriptor);
+
+    _cacheAndPin(shard, page);
+    return page;
+}
+
+
+void pages_cache::_cacheAndPin(shard_t &shard, db_page *page)
+{
+    shard.replacementPolicy->onCached(page);
+    shard.cachedPages.insert(page->id(), page);
     pin(page);
-    _lruAdd(page);
 }
 
 
 void pages_cache::unpin(db_page *page)
 {
     assert( page != nullptr );
-    assert( _cachedPages.find(page->id()) != _cachedPages.end() );
     assert( page->cacheRelatedInfo().pinned > 0 );
 
     page->cacheRelatedInfo().pinned--;
@@ -59,177 +187,1128 @@ void pages_cache::unpin(db_page *page)
 
 void pages_cache::invalidateCachedPage(int pageId)
 {
-    auto pageIt = _cachedPages.find(pageId);
-    assert( pageIt != _cachedPages.end() );
+    db_page *residentPage = _findResident(pageId);
+    if (residentPage != nullptr) {
+        {
+            std::lock_guard<std::mutex> residentLock(_residentPagesMutex);
+            auto residentPages = std::make_shared<resident_pages_t>(*std::atomic_load(&_residentPages));
+            residentPages->erase(std::find(residentPages->begin(), residentPages->end(), residentPage));
+            std::atomic_store(&_residentPages, std::shared_ptr<const resident_pages_t>(residentPages));
+        }
+
+        shard_t &shard = _shard(pageId);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        shard.residentPages--;
+        residentPage->cacheRelatedInfo().dirty = false;
+        _finalizePage(shard, residentPage);
+        return;
+    }
+
+    shard_t &shard = _shard(pageId);
+    std::unique_lock<std::mutex> lock(shard.mutex);
+    _waitForPageIo(shard, lock, pageId);
+    if (shard.compressedTier != nullptr) shard.compressedTier->invalidate(pageId);
+
+    db_page *page = shard.cachedPages.find(pageId);
+    if (page == nullptr) return;   // freed pages are not necessarily cached
+
+    assert( !page->cacheRelatedInfo().isUsed() );
+
+    page->cacheRelatedInfo().dirty = false;    // there is no need to save the freed page
+    shard.replacementPolicy->onRemoved(page, false);
+    _finalizePage(shard, page);
+}
+
+
+void pages_cache::discardAll()
+{
+    _unswizzleAll();
+    _releaseResidentPages(false);
 
-    auto pageCacneInfo = pageIt->second->cacheRelatedInfo();
-    assert( !pageCacneInfo.isUsed() );
+    for (auto &shard : _shards) {
+        std::unique_lock<std::mutex> lock(shard->mutex);
+        _waitForShardIo(*shard, lock);
 
-    _finalizePage(pageIt->second);
-    _lruQueue.erase(pageCacneInfo.lruQueueIterator);
-    _cachedPages.erase(pageId);
+        for (auto &cachedPage : shard->cachedPages) {
+            assert( !cachedPage.page->cacheRelatedInfo().isUsed() );
+            shard->framesPool.release(cachedPage.page);
+        }
+
+        shard->cachedPages.clear();
+        shard->replacementPolicy->clear();
+        if (shard->compressedTier != nullptr) shard->compressedTier->clear();
+    }
 }
 
 
 void pages_cache::makeDirty(db_page *page)
 {
     assert( page != nullptr );
-    assert( _cachedPages.find(page->id()) != _cachedPages.end() );
+    assert( page->cacheRelatedInfo().isUsed() );    // only a pinned page can't be evicted concurrently
 
     auto& cachedPageInfo = page->cacheRelatedInfo();
     cachedPageInfo.dirty = true;
 }
 
 
+void pages_cache::markLogged(db_page *page, uint64_t lsn)
+{
+    assert( page->cacheRelatedInfo().isUsed() );
+
+    // only the first record counts, the page can't be written back before it is unpinned
+    auto &cachedPageInfo = page->cacheRelatedInfo();
+    if (cachedPageInfo.recoveryLsn == 0) cachedPageInfo.recoveryLsn = lsn;
+    cachedPageInfo.pageLsn = lsn;
+}
+
+
+uint64_t pages_cache::oldestRecoveryLsn() const
+{
+    uint64_t oldestLsn = 0;
+    auto notePage = [&oldestLsn](db_page *page) {
+        uint64_t lsn = page->cacheRelatedInfo().recoveryLsn;
+        if (lsn != 0 && (oldestLsn == 0 || lsn < oldestLsn)) oldestLsn = lsn;
+    };
+
+    for (db_page *page : *std::atomic_load(&_residentPages)) {
+        notePage(page);
+    }
+
+    for (auto &shard : _shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        for (auto &cachedPage : shard->cachedPages) {
+            notePage(cachedPage.page);
+        }
+    }
+
+    return oldestLsn;
+}
+
+
+void pages_cache::writeBackLoggedBefore(uint64_t lsn)
+{
+    // the resident pages are fetched without waiting for the writes, so this thread writes them itself
+    std::vector<db_page *> residentPages;
+    for (db_page *page : *std::atomic_load(&_residentPages)) {
+        uint64_t recoveryLsn = page->cacheRelatedInfo().recoveryLsn;
+        if (recoveryLsn != 0 && recoveryLsn < lsn) {
+            pin(page);
+            residentPages.push_back(page);
+        }
+    }
+
+    if (!residentPages.empty()) {
+        try {
+            _writeSorted(residentPages, 1);
+        } catch (...) {
+            for (db_page *page : residentPages) unpin(page);
+            throw;
+        }
+
+        for (db_page *page : residentPages) {
+            page->cacheRelatedInfo().dirty = false;
+            page->cacheRelatedInfo().recoveryLsn = 0;
+            unpin(page);
+        }
+
+        std::lock_guard<std::mutex> lock(_flushStatisticsMutex);
+        _flushStatistics.checkpointWrites += residentPages.size();
+    }
+
+    // so are the pinned ones, the writer thread takes only the unpinned pages
+    for (auto &shard : _shards) {
+        _writeBackShard(*shard, lsn, shard->cachedPages.size(), true);
+    }
+
+    _writeBackLsn = lsn;
+    _startWriterThread();
+    _writerWakeUp.notify_all();
+}
+
+
 void pages_cache::flush()
 {
-    for (auto cachedPage : _cachedPages) {
-        if (cachedPage.second->cacheRelatedInfo().dirty) {
-            _pageWriter(cachedPage.second);
-            cachedPage.second->cacheRelatedInfo().dirty = false;
+    auto startTime = std::chrono::steady_clock::now();
+
+    // the dirty pages are pinned, so they are neither evicted nor taken by the background writer meanwhile
+    std::vector<db_page *> dirtyPages;
+    for (db_page *page : *std::atomic_load(&_residentPages)) {
+        if (page->cacheRelatedInfo().dirty) {
+            pin(page);
+            dirtyPages.push_back(page);
         }
     }
+
+    for (auto &shard : _shards) {
+        std::unique_lock<std::mutex> lock(shard->mutex);
+        _waitForShardIo(*shard, lock);
+
+        for (auto &cachedPage : shard->cachedPages) {
+            if (cachedPage.page->cacheRelatedInfo().dirty) {
+                pin(cachedPage.page);
+                dirtyPages.push_back(cachedPage.page);
+            }
+        }
+    }
+
+    size_t writesCount = 0;
+    try {
+        writesCount = _writeSorted(dirtyPages, _flushThreads);
+    } catch (...) {
+        for (db_page *page : dirtyPages) unpin(page);
+        throw;
+    }
+
+    for (db_page *page : dirtyPages) {
+        page->cacheRelatedInfo().dirty = false;
+        page->cacheRelatedInfo().recoveryLsn = 0;
+        unpin(page);
+    }
+
+    auto flushTime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime);
+
+    std::lock_guard<std::mutex> lock(_flushStatisticsMutex);
+    _flushStatistics.flushes++;
+    _flushStatistics.flushedPages += dirtyPages.size();
+    _flushStatistics.flushWrites += writesCount;
+    _flushStatistics.flushMicroseconds += (size_t) flushTime.count();
+    _flushStatistics.lastFlushMicroseconds = (size_t) flushTime.count();
 }
 
 
-void pages_cache::_finalizePage(db_page *page)
+size_t pages_cache::_writeSorted(std::vector<db_page *> &pages, size_t threadsCount)
 {
+    std::sort(pages.begin(), pages.end(), [](db_page *page1, db_page *page2) {
+        return page1->id() < page2->id();
+    });
+
+    // runs of consecutive ids: the first page and the pages count
+    std::vector<std::pair<size_t, size_t>> runs;
+    for (size_t i = 0; i < pages.size(); ++i) {
+        bool continuesRun = !runs.empty() && runs.back().second < maxWriteRunPages &&
+                            pages[i]->id() == pages[i - 1]->id() + 1;
+        if (continuesRun) runs.back().second++;
+        else runs.emplace_back(i, 1);
+    }
+
+    threadsCount = std::min(threadsCount, runs.size());
+    if (threadsCount <= 1) {
+        for (auto &run : runs) {
+            _pagesWriter(&pages[run.first], run.second);
+        }
+        return runs.size();
+    }
+
+    // the runs are taken by the threads in the file order, the first error is rethrown
+    std::atomic<size_t> nextRun { 0 };
+    std::exception_ptr writeError;
+    std::mutex writeErrorMutex;
+
+    auto writeRuns = [&]() {
+        for (size_t run = nextRun++; run < runs.size(); run = nextRun++) {
+            try {
+                _pagesWriter(&pages[runs[run].first], runs[run].second);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(writeErrorMutex);
+                if (writeError == nullptr) writeError = std::current_exception();
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < threadsCount; ++i) {
+        threads.emplace_back(writeRuns);
+    }
+    writeRuns();
+
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    if (writeError != nullptr) std::rethrow_exception(writeError);
+    return runs.size();
+}
+
+
+void pages_cache::_finalizePage(shard_t &shard, db_page *page)
+{
+    _unswizzleFromParent(page);
+    _unswizzleChildren(page);
+
+    if (page->cacheRelatedInfo().prefetched) shard.statistics.prefetchWasted++;
     if (page->cacheRelatedInfo().dirty) {
-        _pageWriter(page);
+        _pagesWriter(&page, 1);
     }
 
     assert( !page->cacheRelatedInfo().isUsed() );
-    _removeFromCache(page);
-    delete page;
+    shard.cachedPages.erase(page->id());
+    shard.framesPool.release(page);
 }
 
 
 void pages_cache::clearCache()
 {
-    std::vector<db_page *> pages;
-    pages.reserve(_cachedPages.size());
+    _stopPreloadThread();
+    _stopWriterThread();
+    _writeBackLsn = 0;
+    _stopPrefetchThreads();
+    _unswizzleAll();
+    flush();
+    _releaseResidentPages(false);
 
-    for (auto cachedPage : _cachedPages) {
-        if (cachedPage.second->cacheRelatedInfo().dirty)
-            pages.push_back(cachedPage.second);
-    }
+    for (auto &shard : _shards) {
+        std::unique_lock<std::mutex> lock(shard->mutex);
+        _waitForShardIo(*shard, lock);
 
-    _cachedPages.clear();
-    _lruQueue.clear();
+        for (auto &cachedPage : shard->cachedPages) {
+            assert( !cachedPage.page->cacheRelatedInfo().dirty );
+            shard->framesPool.release(cachedPage.page);
+        }
 
-    for (auto page : pages) {
-        _pageWriter(page);
+        shard->cachedPages.clear();
+        shard->replacementPolicy->clear();
+        if (shard->compressedTier != nullptr) shard->compressedTier->clear();
     }
 }
 
 
 pages_cache::~pages_cache()
 {
-    /*
-    _writerThreadWorking = false;
-    _writeQueueCondVar.notify_all();
-    _writerThread->join();
-    */
+    _stopPreloadThread();
+    _stopWriterThread();
+    _stopPrefetchThreads();
 
-    assert( _cachedPages.empty() );
+    for (auto &shard : _shards) {
+        assert( shard->cachedPages.empty() );
+    }
     //clearCache();
 }
 
 
-bool pages_cache::_evict()
+auto pages_cache::statistics() const -> statistics_t
 {
-    _statistics.ecivtionsCount++;
+    statistics_t total;
+    for (auto &shard : _shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
 
-    int pageId = _lruQueue.front();
-    auto pageIt = _cachedPages.find(pageId);
-    assert( pageIt != _cachedPages.end() );
+        total.sizePages += shard->sizePages;
+        total.residentPages += shard->residentPages;
+        total.cachedPages += shard->cachedPages.size();
+        total.memoryBytes += shard->framesPool.residentBytes();
+        total.ecivtionsCount += shard->statistics.ecivtionsCount;
+        total.missesCount += shard->statistics.missesCount;
+        total.fetchesCount += shard->statistics.fetchesCount;
+        total.failedEvictions += shard->statistics.failedEvictions;
+        total.dirtyEvictions += shard->statistics.dirtyEvictions;
+        total.backgroundWrites += shard->statistics.backgroundWrites;
+        total.checkpointWrites += shard->statistics.checkpointWrites;
+        total.prefetchReads += shard->statistics.prefetchReads;
+        total.prefetchHits += shard->statistics.prefetchHits;
+        total.prefetchWasted += shard->statistics.prefetchWasted;
+        total.preloadedPages += shard->statistics.preloadedPages;
+        total.overflowFrames += shard->statistics.overflowFrames;
+        if (shard->compressedTier != nullptr) {
+            total.compressedPages += shard->compressedTier->size();
+            total.compressedBytes += shard->compressedTier->bytes();
+            total.compressedHits += shard->compressedTier->statistics().hits;
+            total.compressedRejected += shard->compressedTier->statistics().rejected;
+        }
+        for (size_t queue = 0; queue < cache_replacement_policy::maxQueues; ++queue) {
+            total.queueHits[queue] += shard->statistics.queueHits[queue];
+        }
+    }
 
-    auto& pageInfo = pageIt->second->cacheRelatedInfo();
-    if (pageInfo.isUsed()) {
-        _statistics.failedEvictions++;
-        return false;
+    {
+        std::lock_guard<std::mutex> lock(_flushStatisticsMutex);
+        total.flushes = _flushStatistics.flushes;
+        total.flushedPages = _flushStatistics.flushedPages;
+        total.flushWrites = _flushStatistics.flushWrites;
+        total.flushMicroseconds = _flushStatistics.flushMicroseconds;
+        total.lastFlushMicroseconds = _flushStatistics.lastFlushMicroseconds;
+        total.checkpointWrites += _flushStatistics.checkpointWrites;
     }
 
-    _lruQueue.pop_front();
+    total.residentHits = _residentHits;
+    total.swizzledHits = _swizzledHits;
+    total.swizzledPages = _swizzledPages;
+    return total;
+}
 
-    //if (pageInfo.dirty) _enqueuePageWrite(pageInfo.page);
-    _finalizePage(pageIt->second);
-    return true;
+
+size_t pages_cache::_shardSizePages(size_t sizePages, size_t shard) const
+{
+    return sizePages / _shards.size() + (shard < sizePages % _shards.size() ? 1 : 0);
 }
 
 
-void pages_cache::_removeFromCache(db_page *page)
+size_t pages_cache::_shardCompressedTierBytes(size_t shardSizePages) const
 {
-    //_pagesCacheMutex.lock();
-    _cachedPages.erase(page->id());
-    //_pagesCacheMutex.unlock();
+    return _compressedTierBytes * shardSizePages / _configuredSizePages;
+}
+
+
+void pages_cache::resize(size_t sizePages)
+{
+    sizePages = std::max(sizePages, _shards.size());
+
+    for (size_t i = 0; i < _shards.size(); ++i) {
+        shard_t &shard = *_shards[i];
+
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+
+            shard.sizePages = _shardSizePages(sizePages, i);
+            shard.replacementPolicy->resize(shard.sizePages);
+            shard.framesPool.setFramesLimit(shard.sizePages);
+            if (shard.compressedTier != nullptr) shard.compressedTier->resize(_shardCompressedTierBytes(shard.sizePages));
+        }
+
+        _shrinkShard(shard);    // growing shards just admit more pages on the next misses
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_prefetchMutex);
+        _maxPrefetchQueueLength = std::max(sizePages / 4, (size_t) 1);
+    }
 }
 
 
-void pages_cache::_lruAdd(db_page *page)
+void pages_cache::takeBackOverflowFrames()
 {
-    while (_lruQueue.size() >= _sizePages && _evict());
+    if (!_framesOverflowed) return;
+
+    for (auto &shard : _shards) {
+        std::unique_lock<std::mutex> lock(shard->mutex);
 
-    _lruQueue.push_back(page->id());
-    page->cacheRelatedInfo().lruQueueIterator = _lruQueue.cend();
-    std::advance(page->cacheRelatedInfo().lruQueueIterator, -1);
+        while (shard->framesUsed() > shard->sizePages) {
+            if (_evict(*shard)) continue;
+
+            if (shard->pagesInIo > 0) {
+                _waitForShardIo(*shard, lock);
+                continue;
+            }
+
+            throw pages_cache_full("all " + std::to_string(shard->framesUsed()) + " frames of a cache shard are pinned");
+        }
+    }
+
+    _framesOverflowed = false;
 }
 
 
-void pages_cache::_lruAccess(db_page *page)
+void pages_cache::_shrinkShard(shard_t &shard)
 {
-    _lruQueue.erase(page->cacheRelatedInfo().lruQueueIterator);
+    while (true) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
 
-    _lruQueue.push_back(page->id());
-    page->cacheRelatedInfo().lruQueueIterator = _lruQueue.cend();
-    std::advance(page->cacheRelatedInfo().lruQueueIterator , -1);
+        for (size_t evicted = 0; evicted < resizeEvictionsBatch; ++evicted) {
+            if (shard.framesUsed() <= shard.sizePages) return;
+            if (!_evict(shard)) return;    // the rest is evicted when unpinned pages are needed
+        }
+    }
+}
+
+
+bool pages_cache::_evict(shard_t &shard)
+{
+    shard.statistics.ecivtionsCount++;
+
+    db_page *page = shard.replacementPolicy->victim();
+    if (page == nullptr) {
+        shard.statistics.failedEvictions++;
+        return false;
+    }
+
+    shard.replacementPolicy->onRemoved(page, true);
+
+    if (page->cacheRelatedInfo().dirty) {
+        shard.statistics.dirtyEvictions++;
+        if (_writerThreadWorking) _writerWakeUp.notify_one();    // the writer is behind
+    }
+
+    if (shard.compressedTier != nullptr) {
+        page->prepareForWriting();    // the header is kept in the page members until the page is written
+        shard.compressedTier->store(page->id(), page->bytes());
+    }
+
+    _finalizePage(shard, page);
+    return true;
+}
+
+
+bool pages_cache::_takeCompressed(shard_t &shard, int pageId, const page_frames_pool::frame &frame)
+{
+    return shard.compressedTier != nullptr && shard.compressedTier->take(pageId, frame.bytes);
+}
+
+
+bool pages_cache::_makeRoom(shard_t &shard, std::unique_lock<std::mutex> &lock)
+{
+    while (shard.framesUsed() >= shard.sizePages) {
+        if (_evict(shard)) continue;
+
+        // the frames held by the background reads and writes are released soon
+        if (shard.pagesInIo > 0) {
+            _waitForShardIo(shard, lock);
+            return false;
+        }
+
+        // the rest is pinned by the operations in progress (under no-steal their pages can't be written yet),
+        // an operation is never failed midway, a strict cache takes the frames back before the next one starts
+        if (_strictSizeLimit) _framesOverflowed = true;
+
+        shard.statistics.overflowFrames++;
+        return true;
+    }
+
+    return true;
 }
 
 
 void pages_cache::pin(db_page *page)
 {
     assert( page != nullptr );
-    assert( _cachedPages.find(page->id()) != _cachedPages.end() );
 
     auto& cachedPageInfo = page->cacheRelatedInfo();
     cachedPageInfo.pinned++;
 }
 
-/*
+
+void pages_cache::_waitForPageIo(shard_t &shard, std::unique_lock<std::mutex> &lock, int pageId)
+{
+    while (true) {
+        db_page *page = shard.cachedPages.find(pageId);
+        bool pageInIo = page != nullptr ? page->cacheRelatedInfo().ioInProgress
+                                        : shard.pagesBeingRead.count(pageId) != 0;
+        if (!pageInIo) return;
+
+        shard.ioFinished.wait(lock);
+    }
+}
+
+
+void pages_cache::_waitForShardIo(shard_t &shard, std::unique_lock<std::mutex> &lock)
+{
+    while (shard.pagesInIo > 0) {
+        shard.ioFinished.wait(lock);
+    }
+}
+
+
+void pages_cache::_startWriterThread()
+{
+    if (_writerThreadWorking) return;
+
+    _writerThreadWorking = true;
+    _writerThread = std::thread([this]() { _writerThreadRoutine(); });
+}
+
+
 void pages_cache::_writerThreadRoutine()
 {
-    std::unique_lock<std::mutex> lock(_writeQueueMutex);
+    const auto roundInterval = std::chrono::milliseconds(10);
+    const double maxWriteBudget = std::max((double) _writerPagesPerSecond / 10, 1.0);
+
+    double writeBudget = 0;
+    size_t nextShard = 0;
+    auto lastRoundTime = std::chrono::steady_clock::now();
+
+    std::unique_lock<std::mutex> lock(_writerMutex);
     while (_writerThreadWorking) {
+        _writerWakeUp.wait_for(lock, roundInterval);
+        if (!_writerThreadWorking) break;
+        lock.unlock();
+
+        // the write rate is limited by the budget refilled with the time passed
+        auto now = std::chrono::steady_clock::now();
+        double secondsPassed = std::chrono::duration<double>(now - lastRoundTime).count();
+        writeBudget = std::min(writeBudget + secondsPassed * _writerPagesPerSecond, maxWriteBudget);
+        lastRoundTime = now;
+
+        for (size_t i = 0; i < _shards.size() && writeBudget >= 1; ++i) {
+            writeBudget -= _cleanShard(*_shards[nextShard], (size_t) writeBudget);
+            nextShard = (nextShard + 1) % _shards.size();
+        }
+
+        // the checkpoint write-back isn't limited by the rate, but goes in runs to let the tree thread in
+        uint64_t writeBackLsn = _writeBackLsn;
+        if (writeBackLsn != 0) {
+            size_t pagesWritten = 0;
+            for (auto &shard : _shards) {
+                pagesWritten += _writeBackShard(*shard, writeBackLsn, maxWriteRunPages, false);
+            }
+            if (pagesWritten == 0) _writeBackLsn.compare_exchange_strong(writeBackLsn, 0);
+        }
+
+        lock.lock();
+    }
+}
+
+
+size_t pages_cache::_cleanShard(shard_t &shard, size_t maxPagesToWrite)
+{
+    std::vector<db_page *> pagesToWrite;
+
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        size_t lowWatermark = std::max(shard.sizePages * _writerCleanPercent / 100, (size_t) 1);
+        size_t cleanPages = shard.sizePages > shard.framesUsed() ? shard.sizePages - shard.framesUsed() : 0;
+
+        // dirty pages are taken from the eviction end until enough pages there can be evicted without writing
+        shard.replacementPolicy->forEachInEvictionOrder([&](db_page *page) {
+            if (cleanPages + pagesToWrite.size() >= lowWatermark || pagesToWrite.size() >= maxPagesToWrite) {
+                return false;
+            }
 
-        while (!_pageToWriteAvaliable) {
-            _writeQueueCondVar.wait(lock);
-            if (!_writerThreadWorking) break;
+            auto &pageInfo = page->cacheRelatedInfo();
+            if (pageInfo.isUsed()) return true;    // being changed (or not yet committed) now
+
+            if (pageInfo.dirty) pagesToWrite.push_back(page);
+            else cleanPages++;
+            return true;
+        });
+
+        for (db_page *page : pagesToWrite) {
+            _takeForWriting(shard, page);
+        }
+    }
+
+    if (pagesToWrite.empty()) return 0;
+
+    _writeTaken(shard, pagesToWrite, &statistics_t::backgroundWrites);
+    return pagesToWrite.size();
+}
+
+
+size_t pages_cache::_writeBackShard(shard_t &shard, uint64_t lsn, size_t maxPagesToWrite, bool pinnedPages)
+{
+    std::vector<db_page *> pagesToWrite;
+
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        for (auto &cachedPage : shard.cachedPages) {
+            if (pagesToWrite.size() >= maxPagesToWrite) break;
+
+            auto &pageInfo = cachedPage.page->cacheRelatedInfo();
+            uint64_t recoveryLsn = pageInfo.recoveryLsn;
+            bool loggedBefore = recoveryLsn != 0 && recoveryLsn < lsn;
+
+            if (loggedBefore && !pageInfo.ioInProgress && pageInfo.isUsed() == pinnedPages) {
+                _takeForWriting(shard, cachedPage.page);
+                pagesToWrite.push_back(cachedPage.page);
+            }
+        }
+    }
+
+    if (pagesToWrite.empty()) return 0;
+
+    _writeTaken(shard, pagesToWrite, &statistics_t::checkpointWrites);
+    return pagesToWrite.size();
+}
+
+
+void pages_cache::_takeForWriting(shard_t &shard, db_page *page)
+{
+    page->cacheRelatedInfo().ioInProgress = true;
+    pin(page);
+    shard.pagesInIo++;
+}
+
+
+void pages_cache::_writeTaken(shard_t &shard, std::vector<db_page *> &pages, size_t statistics_t::*writesCounter)
+{
+    // the pages stay dirty if the write fails, but are given back to the shard anyway
+    std::exception_ptr writeError;
+    try {
+        _writeSorted(pages, 1);
+    } catch (...) {
+        writeError = std::current_exception();
+    }
+    bool written = writeError == nullptr;
+
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        for (db_page *page : pages) {
+            if (written) {
+                page->cacheRelatedInfo().dirty = false;
+                page->cacheRelatedInfo().recoveryLsn = 0;
+            }
+            page->cacheRelatedInfo().ioInProgress = false;
+            unpin(page);
+        }
+
+        shard.pagesInIo -= pages.size();
+        if (written) shard.statistics.*writesCounter += pages.size();
+    }
+
+    shard.ioFinished.notify_all();
+    if (!written) std::rethrow_exception(writeError);
+}
+
+
+void pages_cache::_stopWriterThread()
+{
+    {
+        std::lock_guard<std::mutex> lock(_writerMutex);
+        if (!_writerThreadWorking) return;
+        _writerThreadWorking = false;
+    }
+
+    _writerWakeUp.notify_all();
+    _writerThread.join();
+}
+
+
+void pages_cache::_onFetched(shard_t &shard, db_page *page)
+{
+    auto &pageInfo = page->cacheRelatedInfo();
+    if (pageInfo.prefetched) {
+        pageInfo.prefetched = false;
+        shard.statistics.prefetchHits++;
+    }
+}
+
+
+void pages_cache::prefetch(const std::vector<int> &pageIds)
+{
+    {
+        std::lock_guard<std::mutex> lock(_prefetchMutex);
+        if (!_prefetchThreadsWorking) return;
+
+        for (int pageId : pageIds) {
+            if (_prefetchQueue.size() >= _maxPrefetchQueueLength) break;    // the readers are behind anyway
+            _prefetchQueue.push_back(pageId);
+        }
+    }
+
+    _prefetchQueueChanged.notify_all();
+}
+
+
+void pages_cache::_prefetchThreadRoutine()
+{
+    std::unique_lock<std::mutex> lock(_prefetchMutex);
+    while (true) {
+        _prefetchQueueChanged.wait(lock, [this]() { return !_prefetchThreadsWorking || !_prefetchQueue.empty(); });
+        if (!_prefetchThreadsWorking) break;
+
+        int pageId = _prefetchQueue.front();
+        _prefetchQueue.pop_front();
+
+        lock.unlock();
+        _readAhead(pageId, 1, false);
+        lock.lock();
+    }
+}
+
+
+size_t pages_cache::_readAhead(int firstPageId, size_t pagesCount, bool preloading)
+{
+    std::vector<int> pageIds;
+    std::vector<page_frames_pool::frame> frames;
+    size_t pagesRead = 0;
+
+    // pages that are cached or don't fit split the run into several reads
+    for (size_t i = 0; i <= pagesCount; ++i) {
+        page_frames_pool::frame frame;
+        if (i < pagesCount && _reserveFrame(firstPageId + (int) i, !preloading, frame)) {
+            pageIds.push_back(firstPageId + (int) i);
+            frames.push_back(frame);
+            continue;
         }
 
-        while (!_diskWriteQueue.empty()) {
-            if (_diskWriteQueue.front()->cacheRelatedInfo()->pinned == 0) {
-                //_pageWriter(_diskWriteQueue.front());
-                std::cout << "writing: " << _diskWriteQueue.front()->id() << std::endl;
-                _finalizePage(*_diskWriteQueue.front()->cacheRelatedInfo());
+        if (!pageIds.empty()) pagesRead += _readReserved(pageIds, frames, preloading);
+        pageIds.clear();
+        frames.clear();
+    }
+
+    return pagesRead;
+}
+
+
+bool pages_cache::_reserveFrame(int pageId, bool canEvict, page_frames_pool::frame &frame)
+{
+    if (_findResident(pageId) != nullptr) return false;
+
+    shard_t &shard = _shard(pageId);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if (shard.cachedPages.count(pageId) != 0 || shard.pagesBeingRead.count(pageId) != 0) return false;
+
+    // reading ahead never grows the cache beyond its size
+    while (canEvict && shard.framesUsed() >= shard.sizePages && _evict(shard));
+    if (shard.framesUsed() >= shard.sizePages) return false;
+
+    frame = shard.framesPool.acquire();
+    if (_takeCompressed(shard, pageId, frame)) {
+        // decompressed right away, the run is split as for a cached page
+        db_page *page = db_page::load(pageId, data_blob(frame.bytes, _pageSize), frame.descriptor);
+        page->cacheRelatedInfo().prefetched = true;
+        shard.replacementPolicy->onCached(page);
+        shard.cachedPages.insert(pageId, page);
+        shard.statistics.prefetchReads++;
+        return false;
+    }
+
+    shard.pagesBeingRead.insert(pageId);
+    shard.pagesInIo++;
+    shard.statistics.prefetchReads++;
+    return true;
+}
+
+
+size_t pages_cache::_readReserved(const std::vector<int> &pageIds, const std::vector<page_frames_pool::frame> &frames,
+                                  bool preloading)
+{
+    std::vector<uint8_t *> pagesBytes;
+    for (auto &frame : frames) {
+        pagesBytes.push_back(frame.bytes);
+    }
+
+    size_t pagesRead = _pagesReader(pageIds.front(), pagesBytes.data(), pagesBytes.size());
+
+    for (size_t i = 0; i < pageIds.size(); ++i) {
+        shard_t &shard = _shard(pageIds[i]);
+
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+
+            if (i < pagesRead) {
+                db_page *page = db_page::load(pageIds[i], data_blob(frames[i].bytes, _pageSize), frames[i].descriptor);
+                page->cacheRelatedInfo().prefetched = true;
+                shard.replacementPolicy->onCached(page);
+                shard.cachedPages.insert(pageIds[i], page);
+                if (preloading) shard.statistics.preloadedPages++;
+            } else {
+                shard.framesPool.release(frames[i]);    // the page has never been written
             }
 
-            _diskWriteQueue.pop();
+            shard.pagesBeingRead.erase(pageIds[i]);
+            shard.pagesInIo--;
         }
 
-        _pageToWriteAvaliable = false;
+        shard.ioFinished.notify_all();
     }
+
+    return pagesRead;
 }
 
 
-void pages_cache::_enqueuePageWrite(db_page* page)
+void pages_cache::preload(const std::vector<int> &pageIds, bool inBackground)
 {
-    std::unique_lock<std::mutex> lock(_writeQueueMutex);
+    if (!inBackground) {
+        _preloadPages(pageIds, false);
+        return;
+    }
+
+    _stopPreloadThread();
+    _preloadThreadWorking = true;
+    _preloadThread = std::thread([this, pageIds]() { _preloadPages(pageIds, true); });
+}
+
+
+void pages_cache::_preloadPages(const std::vector<int> &pageIds, bool inBackground)
+{
+    // the hottest pages are taken while there are free frames for them
+    std::vector<size_t> freeFrames;
+    for (auto &shard : _shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        freeFrames.push_back(shard->sizePages > shard->framesUsed() ? shard->sizePages - shard->framesUsed() : 0);
+    }
+
+    std::vector<int> pagesToRead;
+    for (int pageId : pageIds) {
+        size_t &shardFreeFrames = freeFrames[(unsigned) pageId % _shards.size()];
+        if (shardFreeFrames == 0) continue;
+
+        shardFreeFrames--;
+        pagesToRead.push_back(pageId);
+    }
+
+    std::sort(pagesToRead.begin(), pagesToRead.end());
+    pagesToRead.erase(std::unique(pagesToRead.begin(), pagesToRead.end()), pagesToRead.end());
+
+    for (size_t runStart = 0; runStart < pagesToRead.size();) {
+        if (inBackground && !_preloadThreadWorking) break;    // the cache is being closed
+
+        size_t runLength = 1;
+        while (runStart + runLength < pagesToRead.size() && runLength < maxReadAheadRunPages &&
+               pagesToRead[runStart + runLength] == pagesToRead[runStart] + (int) runLength) {
+            ++runLength;
+        }
+
+        _readAhead(pagesToRead[runStart], runLength, true);
+        runStart += runLength;
+    }
+}
+
 
-    _diskWriteQueue.push(page);
-    _pageToWriteAvaliable = true;
-    _writeQueueCondVar.notify_one();
+void pages_cache::_stopPreloadThread()
+{
+    _preloadThreadWorking = false;
+    if (_preloadThread.joinable()) _preloadThread.join();
+}
+
+
+std::vector<int> pages_cache::residentPages() const
+{
+    std::vector<std::vector<int>> shardsPages;
+    for (auto &shard : _shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+
+        std::vector<int> shardPages;
+        shard->replacementPolicy->forEachInEvictionOrder([&](db_page *page) {
+            if (!page->cacheRelatedInfo().prefetched) shardPages.push_back(page->id());    // never used since read
+            return true;
+        });
+
+        shardsPages.emplace_back(shardPages.rbegin(), shardPages.rend());
+    }
+
+    std::vector<int> pageIds;
+    for (db_page *page : *std::atomic_load(&_residentPages)) {
+        pageIds.push_back(page->id());
+    }
+
+    for (size_t position = 0; true; ++position) {
+        size_t pagesTaken = pageIds.size();
+        for (auto &shardPages : shardsPages) {
+            if (position < shardPages.size()) pageIds.push_back(shardPages[position]);
+        }
+
+        if (pageIds.size() == pagesTaken) break;
+    }
+
+    return pageIds;
+}
+
+
+void pages_cache::_stopPrefetchThreads()
+{
+    {
+        std::lock_guard<std::mutex> lock(_prefetchMutex);
+        if (!_prefetchThreadsWorking) return;
+
+        _prefetchThreadsWorking = false;
+        _prefetchQueue.clear();
+    }
+
+    _prefetchQueueChanged.notify_all();
+    for (auto &prefetchThread : _prefetchThreads) {
+        prefetchThread.join();
+    }
+    _prefetchThreads.clear();
+}
+
+
+db_page* pages_cache::_findResident(int pageId) const
+{
+    auto residentPages = std::atomic_load(&_residentPages);
+    if (residentPages->empty()) return nullptr;
+
+    auto pageIt = std::lower_bound(residentPages->begin(), residentPages->end(), pageId,
+                                   [](db_page *page, int id) { return page->id() < id; });
+    return pageIt != residentPages->end() && (*pageIt)->id() == pageId ? *pageIt : nullptr;
+}
+
+
+void pages_cache::setResidentPages(const std::vector<int> &pageIds)
+{
+    std::lock_guard<std::mutex> residentLock(_residentPagesMutex);
+    auto oldResidentPages = std::atomic_load(&_residentPages);
+
+    std::vector<int> newIds(pageIds);
+    std::sort(newIds.begin(), newIds.end());
+    newIds.erase(std::unique(newIds.begin(), newIds.end()), newIds.end());
+
+    auto residentPages = std::make_shared<resident_pages_t>();
+    std::vector<db_page *> enteringPages;
+
+    for (db_page *page : *oldResidentPages) {
+        if (std::binary_search(newIds.begin(), newIds.end(), page->id())) {
+            residentPages->push_back(page);
+            continue;
+        }
+
+        // back under the replacement policy (still found through the old set until the new one is published)
+        shard_t &shard = _shard(page->id());
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        shard.residentPages--;
+        shard.cachedPages.insert(page->id(), page);
+        shard.replacementPolicy->onCached(page);
+    }
+
+    for (int pageId : newIds) {
+        if (_findResident(pageId) != nullptr) continue;    // the old set is still published
+
+        db_page *page = fetchAndPin(pageId);    // pinned pages are neither evicted nor written in background
+        if (page == nullptr) page = loadAndPin(pageId);
+
+        enteringPages.push_back(page);
+        residentPages->push_back(page);
+    }
+
+    std::sort(residentPages->begin(), residentPages->end(), [](db_page *page1, db_page *page2) {
+        return page1->id() < page2->id();
+    });
+    std::atomic_store(&_residentPages, std::shared_ptr<const resident_pages_t>(residentPages));
+
+    for (db_page *page : enteringPages) {
+        shard_t &shard = _shard(page->id());
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        shard.replacementPolicy->onRemoved(page, false);
+        shard.cachedPages.erase(page->id());
+        shard.residentPages++;
+        _unswizzleFromParent(page);    // the resident pages are found without the shards
+        unpin(page);
+    }
+}
+
+
+void pages_cache::_releaseResidentPages(bool writeDirty)
+{
+    std::lock_guard<std::mutex> residentLock(_residentPagesMutex);
+
+    for (db_page *page : *std::atomic_load(&_residentPages)) {
+        shard_t &shard = _shard(page->id());
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        assert( !page->cacheRelatedInfo().isUsed() );
+
+        if (!writeDirty) page->cacheRelatedInfo().dirty = false;
+        shard.residentPages--;
+        _finalizePage(shard, page);
+    }
+
+    std::atomic_store(&_residentPages, std::make_shared<const resident_pages_t>());
+}
+
+
+db_page* pages_cache::fetchChildAndPin(db_page *parent, int childPosition)
+{
+    assert( parent->cacheRelatedInfo().isUsed() );    // so it can't leave the cache with its children links
+    int childId = parent->childAt(childPosition);
+
+    db_page *child = _swizzling ? _fetchSwizzled(parent, childPosition, childId) : nullptr;
+    if (child != nullptr) return child;
+
+    child = fetchAndPin(childId);
+    if (child == nullptr) child = loadAndPin(childId);
+
+    if (_swizzling && !isResident(childId)) _swizzle(parent, childPosition, child);
+    return child;
+}
+
+
+std::mutex &pages_cache::_swizzlingLatch(db_page *parent)
+{
+    return _swizzlingLatches[(uintptr_t) parent / sizeof(db_page) % swizzlingLatchesCount];
+}
+
+
+db_page *pages_cache::_fetchSwizzled(db_page *parent, int childPosition, int childId)
+{
+    // the linked child is cached, and it is kept in the cache by the lock of its shard once its id is checked;
+    // the page table lookup is skipped
+    shard_t &shard = _shard(childId);
+    std::unique_lock<std::mutex> lock(shard.mutex);
+    _waitForPageIo(shard, lock, childId);
+
+    db_page *child = nullptr;
+    {
+        std::lock_guard<std::mutex> latch(_swizzlingLatch(parent));
+        auto &swizzledChildren = parent->cacheRelatedInfo().swizzledChildren;
+        if ((size_t) childPosition < swizzledChildren.size()) child = swizzledChildren[childPosition];
+
+        // the keys have been moved in the parent since the child was linked
+        if (child != nullptr && child->id() != childId) child = nullptr;
+    }
+    if (child == nullptr) return nullptr;
+
+    pin(child);
+    shard.statistics.queueHits[shard.replacementPolicy->onAccess(child)]++;
+    _onFetched(shard, child);
+    _swizzledHits++;
+    return child;
+}
+
+
+void pages_cache::_swizzle(db_page *parent, int childPosition, db_page *child)
+{
+    _unswizzleFromParent(child);    // the child could have been moved by a split or a merge
+
+    std::lock_guard<std::mutex> latch(_swizzlingLatch(parent));
+    auto &swizzledChildren = parent->cacheRelatedInfo().swizzledChildren;
+    if ((size_t) childPosition >= swizzledChildren.size()) {
+        swizzledChildren.resize(std::max((size_t) childPosition, parent->recordCount()) + 1, nullptr);
+    }
+
+    db_page *replacedChild = swizzledChildren[childPosition];
+    if (replacedChild != nullptr) {
+        replacedChild->cacheRelatedInfo().swizzledParent = nullptr;
+        _swizzledPages--;
+    }
+
+    swizzledChildren[childPosition] = child;
+    child->cacheRelatedInfo().swizzledParent = parent;
+    child->cacheRelatedInfo().swizzledPosition = childPosition;
+    _swizzledPages++;
+}
+
+
+void pages_cache::_unswizzleChildren(db_page *page)
+{
+    if (!_swizzling) return;
+
+    std::lock_guard<std::mutex> latch(_swizzlingLatch(page));
+    auto &swizzledChildren = page->cacheRelatedInfo().swizzledChildren;
+    for (db_page *child : swizzledChildren) {
+        if (child == nullptr) continue;
+
+        child->cacheRelatedInfo().swizzledParent = nullptr;
+        _swizzledPages--;
+    }
+
+    swizzledChildren.clear();
+}
+
+
+void pages_cache::_unswizzleFromParent(db_page *page)
+{
+    if (!_swizzling) return;
+
+    // the parent is still cached while the page is linked to it: it unlinks its children under the same latch
+    db_page *parent = page->cacheRelatedInfo().swizzledParent;
+    if (parent == nullptr) return;
+
+    std::lock_guard<std::mutex> latch(_swizzlingLatch(parent));
+    if (page->cacheRelatedInfo().swizzledParent != parent) return;    // the parent has left the cache meanwhile
+
+    parent->cacheRelatedInfo().swizzledChildren[page->cacheRelatedInfo().swizzledPosition] = nullptr;
+    page->cacheRelatedInfo().swizzledParent = nullptr;
+    _swizzledPages--;
+}
+
+
+void pages_cache::_unswizzleAll()
+{
+    for (auto &shard : _shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+
+        for (auto &cachedPage : shard->cachedPages) {
+            _unswizzleChildren(cachedPage.page);
+        }
+    }
+
+    for (db_page *page : *std::atomic_load(&_residentPages)) {
+        std::lock_guard<std::mutex> lock(_shard(page->id()).mutex);
+        _unswizzleChildren(page);
+    }
 }
-*/
 
 //----------------------------------------------------------------------------------------------------------------------
 }
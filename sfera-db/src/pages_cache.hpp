@@ -6,13 +6,23 @@
 
 #include "db_page.hpp"
 #include "cached_page_info.hpp"
+#include "cache_replacement_policy.hpp"
+#include "page_frames_pool.hpp"
+#include "compressed_pages_tier.hpp"
+#include "page_table.hpp"
 
-#include <unordered_map>
+#include <unordered_set>
+#include <deque>
 #include <functional>
 #include <thread>
 #include <condition_variable>
 #include <mutex>
 #include <queue>
+#include <memory>
+#include <vector>
+#include <atomic>
+#include <stdexcept>
+#include <string>
 
 //----------------------------------------------------------------------------------------------------------------------
 
@@ -20,6 +30,18 @@ namespace sfera_db
 {
 
     using pages_cache_internals::cached_page_info;
+    using pages_cache_internals::cache_replacement_policy;
+    using pages_cache_internals::page_frames_pool;
+    using pages_cache_internals::compressed_pages_tier;
+
+//----------------------------------------------------------------------------------------------------------------------
+
+    // back-pressure of a cache with the strict size limit: an operation can't start while all the frames are pinned
+    class pages_cache_full : public std::runtime_error
+    {
+    public:
+        explicit pages_cache_full(const std::string &message) : std::runtime_error(message) { }
+    };
 
 //----------------------------------------------------------------------------------------------------------------------
 
@@ -28,57 +50,198 @@ namespace sfera_db
     public:
         struct statistics_t
         {
+            size_t sizePages       = 0;
+            size_t cachedPages     = 0;
+            size_t memoryBytes     = 0;    // page frames held by the cache
             size_t ecivtionsCount  = 0;
             size_t missesCount     = 0;
             size_t fetchesCount    = 0;
             size_t failedEvictions = 0;
+            size_t dirtyEvictions  = 0;    // the victim had to be written on the eviction path
+            size_t backgroundWrites = 0;
+            size_t prefetchReads   = 0;
+            size_t prefetchHits    = 0;    // prefetched pages fetched afterwards
+            size_t prefetchWasted  = 0;    // prefetched pages evicted without being fetched
+            size_t preloadedPages  = 0;    // read on open (counted in the prefetch hits and waste as well)
+            size_t overflowFrames  = 0;    // taken over the cache size while all the pages were pinned
+            size_t residentPages   = 0;
+            size_t residentHits    = 0;    // not counted in the fetches
+            size_t swizzledPages   = 0;
+            size_t swizzledHits    = 0;    // not counted in the fetches
+            size_t compressedPages = 0;
+            size_t compressedBytes = 0;
+            size_t compressedHits  = 0;    // misses served by the compressed tier
+            size_t compressedRejected = 0;    // evicted pages not worth compressing
+            size_t flushes         = 0;    // including the one on close
+            size_t flushedPages    = 0;
+            size_t flushWrites     = 0;    // runs of consecutive pages written at once
+            size_t flushMicroseconds     = 0;
+            size_t lastFlushMicroseconds = 0;
+            size_t checkpointWrites = 0;    // pages written back for the checkpoints
+            size_t queueHits[cache_replacement_policy::maxQueues] = {};    // see replacementPolicy().queueName()
+        };
+
+
+    private:
+        // pages are spread over the shards by id, each shard has its own lock, replacement state and frames
+        struct shard_t
+        {
+            mutable std::mutex mutex;
+            std::condition_variable ioFinished;
+            statistics_t statistics;
+            size_t sizePages;
+            size_t pagesInIo = 0;    // being written by the background writer or read by the prefetch threads
+            std::unordered_set<int> pagesBeingRead;    // not cached yet, but occupy frames
+            size_t residentPages = 0;    // moved to the resident set, but occupy frames
+
+            page_table cachedPages;
+            std::unique_ptr<cache_replacement_policy> replacementPolicy;
+            page_frames_pool framesPool;
+            std::unique_ptr<compressed_pages_tier> compressedTier;    // nullptr if disabled
+
+            shard_t(size_t sizePages, size_t pageSize, pages_replacement_policy replacementPolicy, bool hugePages,
+                    size_t compressedTierBytes);
+            inline size_t framesUsed() const  { return cachedPages.size() + pagesBeingRead.size() + residentPages; }
         };
 
+        static const size_t maxAutoShardsCount = 16;
+        static const size_t minAutoShardSizePages = 64;
+        static const size_t resizeEvictionsBatch = 32;    // evicted under one shard lock while shrinking
+        static const size_t maxReadAheadRunPages = 64;
+        static const size_t maxWriteRunPages = 64;
+        static const size_t swizzlingLatchesCount = 64;
+
+        typedef std::vector<db_page *> resident_pages_t;    // sorted by the page id
 
     private:
-        statistics_t _statistics;
-        std::function<void(db_page*)> _pageWriter;
-        size_t _sizePages;
-
-        std::unordered_map<int, db_page*> _cachedPages;
-        std::list<int> _lruQueue;
-
-        /*
-        bool _writerThreadWorking = true;
-        std::thread* _writerThread;
-        std::queue<db_page*> _diskWriteQueue;
-        std::mutex _writeQueueMutex;
-        std::mutex _pagesCacheMutex;
-        std::condition_variable _writeQueueCondVar;
-        bool _pageToWriteAvaliable = false;
-        */
+        std::function<void(db_page *const *, size_t)> _pagesWriter;    // consecutive pages
+        std::function<size_t(int, uint8_t *const *, size_t)> _pagesReader;    // consecutive pages, returns the pages read
+        size_t _pageSize;
+        std::vector<std::unique_ptr<shard_t>> _shards;
+
+        size_t _writerPagesPerSecond;
+        unsigned _writerCleanPercent;
+        std::atomic<bool> _writerThreadWorking { false };
+        std::thread _writerThread;
+        std::mutex _writerMutex;
+        std::condition_variable _writerWakeUp;
+
+        std::vector<std::thread> _prefetchThreads;
+        bool _prefetchThreadsWorking = false;
+        std::deque<int> _prefetchQueue;
+        size_t _maxPrefetchQueueLength = 0;
+        std::mutex _prefetchMutex;
+        std::condition_variable _prefetchQueueChanged;
+
+        std::thread _preloadThread;
+        std::atomic<bool> _preloadThreadWorking { false };
+
+        // the set is replaced as a whole and read without locks, it is changed by the thread working with the tree
+        std::shared_ptr<const resident_pages_t> _residentPages;
+        std::mutex _residentPagesMutex;
+        std::atomic<size_t> _residentHits { 0 };
+
+        bool _swizzling;
+        std::mutex _swizzlingLatches[swizzlingLatchesCount];    // taken after a shard lock, see _swizzlingLatch
+        std::atomic<size_t> _swizzledPages { 0 };
+        std::atomic<size_t> _swizzledHits { 0 };
+
+        size_t _flushThreads;
+        bool _strictSizeLimit;
+        size_t _compressedTierBytes;     // for the configured size, the tier is resized in proportion to the frames
+        size_t _configuredSizePages;
+        std::atomic<bool> _framesOverflowed { false };    // by an operation of a strict cache
+        mutable std::mutex _flushStatisticsMutex;
+        statistics_t _flushStatistics;    // only the flush and checkpoint counters are used
+
+        std::atomic<uint64_t> _writeBackLsn { 0 };    // the pages logged before are written by the writer thread
 
     private:
-        void _finalizePage(db_page *page);
-        bool _evict();
-        void _lruAdd(db_page *page);
-        void _lruAccess(db_page *page);
+        inline shard_t &_shard(int pageId) const  { return *_shards[(unsigned) pageId % _shards.size()]; }
+        size_t _shardSizePages(size_t sizePages, size_t shard) const;
+        size_t _shardCompressedTierBytes(size_t shardSizePages) const;
+        void _shrinkShard(shard_t &shard);
+
+        void _finalizePage(shard_t &shard, db_page *page);
+        bool _evict(shard_t &shard);
+        bool _makeRoom(shard_t &shard, std::unique_lock<std::mutex> &lock);    // false if the lock has been released
+        void _cacheAndPin(shard_t &shard, db_page *page);
+
+        void _waitForPageIo(shard_t &shard, std::unique_lock<std::mutex> &lock, int pageId);
+        void _waitForShardIo(shard_t &shard, std::unique_lock<std::mutex> &lock);
 
-        void _enqueuePageWrite(db_page* page);
-        void _removeFromCache(db_page *page);
+        void _startWriterThread();
         void _writerThreadRoutine();
+        size_t _cleanShard(shard_t &shard, size_t maxPagesToWrite);
+        size_t _writeBackShard(shard_t &shard, uint64_t lsn, size_t maxPagesToWrite, bool pinnedPages);
+        void _takeForWriting(shard_t &shard, db_page *page);    // under the shard lock
+        void _writeTaken(shard_t &shard, std::vector<db_page *> &pages, size_t statistics_t::*writesCounter);
+        void _stopWriterThread();
+        size_t _writeSorted(std::vector<db_page *> &pages, size_t threadsCount);    // returns the writes made
+
+        void _prefetchThreadRoutine();
+        size_t _readAhead(int firstPageId, size_t pagesCount, bool preloading);    // preloading doesn't evict
+        bool _reserveFrame(int pageId, bool canEvict, page_frames_pool::frame &frame);
+        size_t _readReserved(const std::vector<int> &pageIds, const std::vector<page_frames_pool::frame> &frames,
+                             bool preloading);
+        void _preloadPages(const std::vector<int> &pageIds, bool inBackground);
+        void _stopPreloadThread();
+
+        db_page* _findResident(int pageId) const;
+        void _releaseResidentPages(bool writeDirty);
+
+        std::mutex &_swizzlingLatch(db_page *parent);    // guards the children of the parent and their links to it
+        db_page *_fetchSwizzled(db_page *parent, int childPosition, int childId);
+        void _swizzle(db_page *parent, int childPosition, db_page *child);    // both pinned
+        void _unswizzleChildren(db_page *page);
+        void _unswizzleFromParent(db_page *page);    // the page can't be pinned by another thread meanwhile
+        void _unswizzleAll();
+        void _stopPrefetchThreads();
+        void _onFetched(shard_t &shard, db_page *page);
+        bool _takeCompressed(shard_t &shard, int pageId, const page_frames_pool::frame &frame);
 
     public:
-        pages_cache(size_t sizePages, std::function<void(db_page*)> pageWriter);
+        pages_cache(const pages_cache_config &config, size_t pageSize,
+                    std::function<void(db_page *const *, size_t)> pagesWriter,
+                    std::function<size_t(int, uint8_t *const *, size_t)> pagesReader);
         ~pages_cache();
 
-        void flush();
+        void flush();    // writes all the dirty pages sorted by id, consecutive pages at once
         void clearCache();
+        void discardAll();
+        void resize(size_t sizePages);    // shrinking evicts the extra pages in small batches
+        void takeBackOverflowFrames();    // a strict cache throws pages_cache_full if they are still pinned
 
         db_page* fetchAndPin(int pageId);
-        void cacheAndPin(db_page *page);
+        db_page* loadAndPin(int pageId);
+        db_page* createAndPin(int pageId, bool isLeaf);
+        db_page* fetchChildAndPin(db_page *parent, int childPosition);    // the parent has to be pinned
         void invalidateCachedPage(int pageId);
+        void prefetch(const std::vector<int> &pageIds);    // asynchronous, pages already cached are skipped
+
+        // reads the pages into the free frames (the hottest first), consecutive pages are read at once
+        void preload(const std::vector<int> &pageIds, bool inBackground);
+        std::vector<int> residentPages() const;    // the hottest first, interleaved over the shards
+
+        // the pages are kept outside the replacement policy and found without the shards lookup
+        void setResidentPages(const std::vector<int> &pageIds);
+        inline bool isResident(int pageId) const  { return _findResident(pageId) != nullptr; }
         void makeDirty(db_page *page);
+        void markLogged(db_page *page, uint64_t lsn);    // the page changes have been logged in the record
+
+        // the least recovery lsn of the dirty pages or 0 if no dirty page has been logged
+        uint64_t oldestRecoveryLsn() const;
+
+        // the resident and pinned pages are written at once, the rest by the writer thread in the background;
+        // has to be called by the thread working with the tree between the operations
+        void writeBackLoggedBefore(uint64_t lsn);
 
         void pin(db_page* page);
         void unpin(db_page *page);
 
-        inline const statistics_t &statistics() const  { return _statistics; }
+        statistics_t statistics() const;    // summed over the shards
+        inline const cache_replacement_policy &replacementPolicy() const  { return *_shards[0]->replacementPolicy; }
+        inline size_t shardsCount() const  { return _shards.size(); }
     };
 
 }
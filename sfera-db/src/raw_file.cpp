@@ -5,9 +5,12 @@
 #include <iostream>
 
 #include <fcntl.h>
+#include <cerrno>
 #include <sys/stat.h>
 #include <sys/uio.h>
 #include <cassert>
+#include <vector>
+#include <algorithm>
 
 //----------------------------------------------------------------------------------------------------------------------
 
@@ -75,6 +78,12 @@ bool raw_file::exists(const std::string &path)
 }
 
 
+void raw_file::remove(const std::string &path)
+{
+    syscall_check( ::unlink(path.c_str()) );
+}
+
+
 void raw_file::ensureSizeIsAtLeast(size_t neededSize)
 {
     if (_actualFileSize < neededSize) {
@@ -84,6 +93,20 @@ void raw_file::ensureSizeIsAtLeast(size_t neededSize)
 }
 
 
+void raw_file::preallocate(size_t size)
+{
+    int fallocateResult = ::fallocate(_unixFD, FALLOC_FL_KEEP_SIZE, 0, (off_t) size);
+    if (fallocateResult == -1 && errno == EOPNOTSUPP) return;    // the space is allocated on writes then
+    syscall_check( fallocateResult );
+}
+
+
+void raw_file::sync()
+{
+    syscall_check( ::fdatasync(_unixFD) );
+}
+
+
 off_t raw_file::writeAll(off_t offset, const void *data, size_t length)
 {
     _eof = false;
@@ -99,19 +122,91 @@ off_t raw_file::writeAll(off_t offset, const void *data, size_t length)
 }
 
 
+off_t raw_file::writeAll(off_t offset, std::pair<const void *, size_t> buffers[], size_t buffersCount)
+{
+    _eof = false;
+
+    std::vector<struct iovec> iovs(buffersCount);
+    size_t length = 0;
+    for (size_t i = 0; i < buffersCount; ++i) {
+        iovs[i].iov_base = const_cast<void *>(buffers[i].first);
+        iovs[i].iov_len  = buffers[i].second;
+        length += buffers[i].second;
+    }
+
+    size_t writtenBytes = 0;
+    size_t nextIov = 0;
+    while (nextIov < iovs.size()) {
+        int iovsCount = (int) std::min(iovs.size() - nextIov, (size_t) ::sysconf(_SC_IOV_MAX));
+        ssize_t writeResult = ::pwritev(_unixFD, &iovs[nextIov], iovsCount, offset + writtenBytes);
+        syscall_check( writeResult );
+        writtenBytes += writeResult;
+
+        // skip the written buffers and adjust the partially written one
+        for (size_t left = (size_t) writeResult; left > 0;) {
+            size_t taken = std::min(left, iovs[nextIov].iov_len);
+            iovs[nextIov].iov_base = (uint8_t *) iovs[nextIov].iov_base + taken;
+            iovs[nextIov].iov_len -= taken;
+            left -= taken;
+
+            if (iovs[nextIov].iov_len == 0) ++nextIov;
+        }
+        while (nextIov < iovs.size() && iovs[nextIov].iov_len == 0) ++nextIov;
+    }
+
+    return offset + length;
+}
+
+
 off_t raw_file::readAll(off_t offset, void *data, size_t length) const
+{
+    if (!tryReadAll(offset, data, length)) _eof = true;
+    return offset + length;
+}
+
+
+bool raw_file::tryReadAll(off_t offset, void *data, size_t length) const
 {
     for (size_t readBytes = 0; readBytes < length;) {
         ssize_t readResult = ::pread(_unixFD, (uint8_t *)data + readBytes, length - readBytes, offset + readBytes);
         syscall_check( readResult );
-        if (readResult == 0) {
-            _eof = true;
-            return offset + length;
-        }
+        if (readResult == 0) return false;
         readBytes += readResult;
     }
 
-    return offset + length;
+    return true;
+}
+
+
+size_t raw_file::tryReadAll(off_t offset, std::pair<void *, size_t> buffers[], size_t buffersCount) const
+{
+    std::vector<struct iovec> iovs(buffersCount);
+    for (size_t i = 0; i < buffersCount; ++i) {
+        iovs[i].iov_base = buffers[i].first;
+        iovs[i].iov_len  = buffers[i].second;
+    }
+
+    size_t readBytes = 0;
+    size_t nextIov = 0;
+    while (nextIov < iovs.size()) {
+        int iovsCount = (int) std::min(iovs.size() - nextIov, (size_t) ::sysconf(_SC_IOV_MAX));
+        ssize_t readResult = ::preadv(_unixFD, &iovs[nextIov], iovsCount, offset + readBytes);
+        syscall_check( readResult );
+        if (readResult == 0) break;
+        readBytes += readResult;
+
+        // skip the filled buffers and adjust the partially filled one
+        for (size_t left = (size_t) readResult; left > 0;) {
+            size_t taken = std::min(left, iovs[nextIov].iov_len);
+            iovs[nextIov].iov_base = (uint8_t *) iovs[nextIov].iov_base + taken;
+            iovs[nextIov].iov_len -= taken;
+            left -= taken;
+
+            if (iovs[nextIov].iov_len == 0) ++nextIov;
+        }
+    }
+
+    return readBytes;
 }
 
 
@@ -130,30 +225,43 @@ void raw_file::appedAll(const void *data, size_t length)
 
 void raw_file::appedAll(std::pair<void const *, size_t> buffers[], size_t buffersCount)
 {
-    assert( buffersCount <= ::sysconf(_SC_IOV_MAX) );
     _eof = false;
 
-    struct iovec iovs[buffersCount];
-    size_t summLen = 0;
+    std::vector<struct iovec> iovs(buffersCount);
     for (size_t i = 0; i < buffersCount; ++i) {
         iovs[i].iov_base = const_cast<void*> (buffers[i].first);
         iovs[i].iov_len  = buffers[i].second;
-
-        summLen += buffers[i].second;
     }
 
-    int writtenBuffs = 0;
-    for (size_t writtenBytes = 0; writtenBytes < summLen;) {
-        ssize_t writeResult = ::writev(_unixFD, &iovs[0], (int)buffersCount);
+    size_t nextIov = 0;
+    while (nextIov < iovs.size()) {
+        int iovsCount = (int) std::min(iovs.size() - nextIov, (size_t) ::sysconf(_SC_IOV_MAX));
+        ssize_t writeResult = ::writev(_unixFD, &iovs[nextIov], iovsCount);
         syscall_check( writeResult );
 
-        assert( writeResult == summLen ); // TODO: not implemented correctly
+        // skip the written buffers and adjust the partially written one
+        for (size_t left = (size_t) writeResult; left > 0;) {
+            size_t taken = std::min(left, iovs[nextIov].iov_len);
+            iovs[nextIov].iov_base = (uint8_t *) iovs[nextIov].iov_base + taken;
+            iovs[nextIov].iov_len -= taken;
+            left -= taken;
 
-        writtenBytes += writeResult;
+            if (iovs[nextIov].iov_len == 0) ++nextIov;
+        }
+        while (nextIov < iovs.size() && iovs[nextIov].iov_len == 0) ++nextIov;
     }
 }
 
 
+size_t raw_file::blockSize() const
+{
+    struct stat fileStat;
+    syscall_check( ::fstat(_unixFD, &fileStat) );
+
+    return (size_t) fileStat.st_blksize;
+}
+
+
 size_t raw_file::readAll(void *data, size_t length)
 {
     size_t readBytes = 0;
@@ -6,6 +6,7 @@
 
 #include <unistd.h>
 #include <string>
+#include <atomic>
 
 //----------------------------------------------------------------------------------------------------------------------
 
@@ -17,7 +18,7 @@ namespace sfera_db
     private:
         int _unixFD = -1;
         size_t _actualFileSize = 0;
-        mutable bool _eof = false;
+        mutable std::atomic<bool> _eof { false };    // the pages cache writer shares the file
 
 
     private:
@@ -28,10 +29,16 @@ namespace sfera_db
         static raw_file* createNew(const std::string& path, bool writeOnly = false);
         static raw_file* openExisting(const std::string& path, bool readOnly = false);
         static bool exists(const std::string& path);
+        static void remove(const std::string& path);
 
         void  ensureSizeIsAtLeast(size_t neededSize);
+        void  preallocate(size_t size);    // allocates the disk space, the file size doesn't change
+        void  sync();    // the data written reaches the disk (the metadata only as much as needed to read it)
         off_t writeAll(off_t offset, const void *data, size_t length);
+        off_t writeAll(off_t offset, std::pair<const void *, size_t> buffers[], size_t buffersCount);
         off_t readAll(off_t offset, void *data, size_t length) const;
+        bool  tryReadAll(off_t offset, void *data, size_t length) const;    // false at the end of file (doesn't touch eof)
+        size_t tryReadAll(off_t offset, std::pair<void *, size_t> buffers[], size_t buffersCount) const;    // bytes read
 
         size_t readAll(void *data, size_t length);
 
@@ -40,6 +47,7 @@ namespace sfera_db
 
         bool eof();
 
+        size_t blockSize() const;    // of the file system, the preferred write size
         inline size_t actualSize() const  { return _actualFileSize; }
         inline int unixFD() const  { return _unixFD; }
     };
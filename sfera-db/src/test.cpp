@@ -2,8 +2,17 @@
 #include <iostream>
 #include <vector>
 #include <algorithm>
+#include <thread>
+#include <chrono>
+#include <random>
+#include <unordered_map>
+
+#include <unistd.h>
+#include <sys/wait.h>
+#include <dirent.h>
 
 #include "database.hpp"
+#include "page_table.hpp"
 
 using namespace sfera_db;
 
@@ -50,6 +59,882 @@ void testOpening(std::vector<std::pair<data_blob, data_blob>> &testSet)
 }
 
 
+// the process is killed after the deletes have freed pages and the inserts have reused them
+void crashAfterChanges(const std::string &path, std::vector<std::pair<data_blob, data_blob>> &testSet,
+                       const database_config &dbConfig)
+{
+    pid_t pid = ::fork();
+    if (pid == 0) {
+        database *db = database::createEmpty(path, dbConfig);
+
+        for (size_t i = 0; i < testSet.size(); ++i) {
+            db->insert(testSet[i].first, testSet[i].second);
+        }
+        for (size_t i = 0; i < testSet.size(); ++i) {
+            if (i % 10 != 0) db->remove(testSet[i].first);
+        }
+        for (size_t i = 0; i < testSet.size(); ++i) {
+            if (i % 10 != 0 && i % 3 != 0) db->insert(testSet[i].first, data_blob::fromCopyOf("new " + std::to_string(i)));
+        }
+
+        ::_exit(0);    // neither the pages nor the log are closed
+    }
+
+    int status = 0;
+    ::waitpid(pid, &status, 0);
+}
+
+
+bool checkRecovered(database *db, std::vector<std::pair<data_blob, data_blob>> &testSet)
+{
+    bool recoveryOK = true;
+    for (size_t i = 0; i < testSet.size(); ++i) {
+        std::string expected = i % 10 == 0 ? testSet[i].second.toString() : i % 3 != 0 ? "new " + std::to_string(i) : "";
+        data_blob_copy result = db->get(testSet[i].first);
+
+        if ((result.valid() ? result.toString() : "") != expected) {
+            std::cout << "RECOVERED " << testSet[i].first.toString() << " = " << result.toString() << std::endl;
+            recoveryOK = false;
+        }
+
+        result.release();
+    }
+
+    return recoveryOK;
+}
+
+
+// the reopened database must hold every key committed before the crash, whether the log has the page images
+// or the page changes, and the pages written by the recovery threads must be the ones of a serial replay
+bool testCrashRecovery(std::vector<std::pair<data_blob, data_blob>> &testSet, database_config dbConfig)
+{
+    dbConfig.logDurability = log_durability::per_commit;
+
+    bool recoveryOK = true;
+    for (bool logPageChanges : { false, true }) {
+        dbConfig.logPageChanges = logPageChanges;
+        crashAfterChanges("test_crash_db", testSet, dbConfig);
+        crashAfterChanges("test_crash_db_serial", testSet, dbConfig);
+
+        dbConfig.recoveryThreads = 4;
+        database *db = database::openExisting("test_crash_db", dbConfig);
+        dbConfig.recoveryThreads = 1;
+        database *serialDB = database::openExisting("test_crash_db_serial", dbConfig);
+
+        bool logOK = checkRecovered(db, testSet) && checkRecovered(serialDB, testSet) &&
+                     db->dumpTree() == serialDB->dumpTree();
+        std::cout << "CRASH RECOVERY TEST (" << (logPageChanges ? "changes" : "images") << "): " << logOK << std::endl;
+        recoveryOK = recoveryOK && logOK;
+
+        delete serialDB;
+        delete db;
+    }
+
+    return recoveryOK;
+}
+
+
+database *createFilled(const std::string &path, std::vector<std::pair<data_blob, data_blob>> &testSet,
+                       const database_config &dbConfig)
+{
+    database *db = database::createEmpty(path, dbConfig);
+    for (size_t i = 0; i < testSet.size(); ++i) {
+        db->insert(testSet[i].first, testSet[i].second);
+    }
+
+    return db;
+}
+
+
+// the value of the key or an empty string if there is no such key
+std::string lookup(database *db, data_blob key)
+{
+    data_blob_copy result = db->get(key);
+    std::string value = result.valid() ? result.toString() : "";
+    result.release();
+
+    return value;
+}
+
+
+// one of the numbers printed by dumpCacheStatistics
+size_t statistic(database *db, const std::string &name)
+{
+    std::string statistics = "\n" + db->dumpCacheStatistics();
+    size_t position = statistics.find("\n" + name + ": ");
+    return position == std::string::npos ? 0 : std::stoul(statistics.substr(position + name.length() + 3));
+}
+
+
+// several threads insert at once and each insert returns once its record is synced: with group commit the first
+// waiter syncs the records logged meanwhile too, so there are fewer syncs than commits and none of them is lost
+bool testGroupCommit(std::vector<std::pair<data_blob, data_blob>> &testSet, database_config dbConfig)
+{
+    const size_t threadsCount = 8;
+
+    bool commitOK = true;
+    for (log_durability durability : { log_durability::per_commit, log_durability::group_commit }) {
+        dbConfig.logDurability = durability;
+        const char *durabilityName = durability == log_durability::group_commit ? "group commit" : "per commit";
+
+        pid_t pid = ::fork();
+        if (pid == 0) {
+            database *db = database::createEmpty("test_commit_db", dbConfig);
+            auto startTime = std::chrono::steady_clock::now();
+
+            std::vector<std::thread> threads;
+            for (size_t t = 0; t < threadsCount; ++t) {
+                threads.emplace_back([&, t]() {
+                    for (size_t i = t; i < testSet.size(); i += threadsCount) {
+                        db->insert(testSet[i].first, testSet[i].second);
+                    }
+                });
+            }
+            for (auto &thread : threads) thread.join();
+
+            auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime);
+            size_t commits = statistic(db, "commits");
+            size_t syncs = statistic(db, "log syncs");
+            std::cout << "COMMITS (" << durabilityName << ", " << threadsCount << " threads): "
+                      << testSet.size() * 1000000 / std::max((size_t) elapsed.count(), (size_t) 1) << " per second, "
+                      << elapsed.count() * threadsCount / testSet.size() << " us per insert, "
+                      << syncs << " syncs for " << commits << " commits, "
+                      << statistic(db, "commit time us") / std::max(commits, (size_t) 1) << " us average sync wait, "
+                      << statistic(db, "max commit time us") << " us max" << std::endl;
+
+            bool grouped = durability != log_durability::group_commit || syncs < commits;
+            ::_exit(grouped && commits == testSet.size() ? 0 : 1);    // the log is not closed
+        }
+
+        int status = 0;
+        ::waitpid(pid, &status, 0);
+
+        database *db = database::openExisting("test_commit_db", dbConfig);
+        bool durabilityOK = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        for (size_t i = 0; i < testSet.size() && durabilityOK; ++i) {
+            data_blob_copy result = db->get(testSet[i].first);
+            durabilityOK = result.toString() == testSet[i].second.toString();
+            result.release();
+        }
+        delete db;
+
+        std::cout << "GROUP COMMIT TEST (" << durabilityName << "): " << durabilityOK << std::endl;
+        commitOK = commitOK && durabilityOK;
+    }
+
+    return commitOK;
+}
+
+
+// the deletes only flag the underfull pages, the flags outlive a reopen and compact() rebalances the flagged pages
+bool testDeferredRebalancing(std::vector<std::pair<data_blob, data_blob>> &testSet, database_config dbConfig)
+{
+    dbConfig.deferredRebalancing = true;
+    dbConfig.maxDeferredRebalances = testSet.size();
+
+    database *db = database::createEmpty("test_defer_db", dbConfig);
+    for (size_t i = 0; i < testSet.size(); ++i) {
+        db->insert(testSet[i].first, testSet[i].second);
+    }
+    for (size_t i = 0; i < testSet.size(); ++i) {
+        if (i % 10 != 0) db->remove(testSet[i].first);
+    }
+    size_t deferredCount = statistic(db, "deferred rebalances");
+    delete db;
+
+    db = database::openExisting("test_defer_db", dbConfig);
+    bool deferOK = deferredCount > 0 && statistic(db, "deferred rebalances") == deferredCount;
+    std::string underfullTree = db->dumpTree();
+
+    db->compact();
+    deferOK = deferOK && statistic(db, "deferred rebalances") == 0 && db->dumpTree().size() < underfullTree.size();
+    for (size_t i = 0; i < testSet.size() && deferOK; ++i) {
+        data_blob_copy result = db->get(testSet[i].first);
+        deferOK = (result.valid() ? result.toString() : "") == (i % 10 == 0 ? testSet[i].second.toString() : "");
+        result.release();
+    }
+    delete db;
+
+    std::cout << "DEFERRED REBALANCING TEST: " << deferOK << std::endl;
+    return deferOK;
+}
+
+
+// a database opened without a cache size gets the one it has been closed with, and reads the pages cached at
+// the close only when asked to
+bool testCachePreload(std::vector<std::pair<data_blob, data_blob>> &testSet, database_config dbConfig)
+{
+    database *db = database::createEmpty("test_preload_db", dbConfig);
+    for (size_t i = 0; i < testSet.size(); ++i) {
+        db->insert(testSet[i].first, testSet[i].second);
+    }
+    db->setCacheSize(64 * dbConfig.pageSizeBytes);
+    delete db;
+
+    dbConfig.cacheSizePages = 0;
+    bool preloadOK = true;
+    for (cache_preload_mode preloadMode : { cache_preload_mode::none, cache_preload_mode::synchronous }) {
+        dbConfig.cachePreload = preloadMode;
+        db = database::openExisting("test_preload_db", dbConfig);
+
+        size_t preloadedPages = statistic(db, "preloaded pages");
+        preloadOK = preloadOK && statistic(db, "cache size pages") == 64 &&
+                    (preloadMode == cache_preload_mode::none ? preloadedPages == 0 : preloadedPages > 0);
+
+        for (size_t i = 0; i < testSet.size(); ++i) {
+            data_blob_copy result = db->get(testSet[i].first);
+            preloadOK = preloadOK && result.toString() == testSet[i].second.toString();
+            result.release();
+        }
+        delete db;
+    }
+
+    std::cout << "CACHE PRELOAD TEST: " << preloadOK << std::endl;
+    return preloadOK;
+}
+
+
+// the keys from the first to the last given one are removed whatever pages they are spread over, the rest stay,
+// and the truncated tree takes new keys as an empty one
+bool testRangeRemoval(std::vector<std::pair<data_blob, data_blob>> &testSet, database_config dbConfig)
+{
+    database *db = createFilled("test_range_db", testSet, dbConfig);
+
+    std::vector<std::string> keys;
+    for (auto &record : testSet) keys.push_back(record.first.toString());
+    std::sort(keys.begin(), keys.end());
+    std::string firstKey = keys[keys.size() / 5], lastKey = keys[keys.size() * 3 / 5];
+
+    db->removeRange(data_blob::fromCopyOf(firstKey), data_blob::fromCopyOf(lastKey));
+    bool rangeOK = true;
+    for (size_t i = 0; i < testSet.size() && rangeOK; ++i) {
+        std::string key = testSet[i].first.toString();
+        bool removed = key >= firstKey && key <= lastKey;
+        rangeOK = lookup(db, testSet[i].first) == (removed ? "" : testSet[i].second.toString());
+    }
+
+    db->truncate();
+    for (size_t i = 0; i < testSet.size() && rangeOK; ++i) {
+        rangeOK = lookup(db, testSet[i].first).empty();
+    }
+    db->insert(testSet[0].first, testSet[0].second);
+    rangeOK = rangeOK && lookup(db, testSet[0].first) == testSet[0].second.toString();
+    delete db;
+
+    std::cout << "RANGE REMOVAL TEST: " << rangeOK << std::endl;
+    return rangeOK;
+}
+
+
+// the hot keys are found through the hash index, and once the splits and merges have moved them the entries are
+// found stale instead of pointing at other records
+bool testHashIndex(std::vector<std::pair<data_blob, data_blob>> &testSet, database_config dbConfig)
+{
+    const size_t hotKeys = 100;
+    dbConfig.hashIndexEntries = 512;
+    dbConfig.hashIndexAdmissionLookups = 2;
+
+    database *db = database::createEmpty("test_hash_db", dbConfig);
+    for (size_t i = 0; i < testSet.size() / 2; ++i) {
+        db->insert(testSet[i].first, testSet[i].second);
+    }
+    for (int pass = 0; pass < 3; ++pass) {
+        for (size_t i = 0; i < hotKeys; ++i) lookup(db, testSet[i].first);
+    }
+    bool indexOK = statistic(db, "hash index entries") > 0 && statistic(db, "hash index hits") > 0;
+
+    for (size_t i = testSet.size() / 2; i < testSet.size(); ++i) {
+        db->insert(testSet[i].first, testSet[i].second);
+    }
+    for (size_t i = 1; i < testSet.size(); i += 2) {
+        db->remove(testSet[i].first);
+    }
+    for (size_t i = 0; i < testSet.size() && indexOK; ++i) {
+        indexOK = lookup(db, testSet[i].first) == (i % 2 == 0 ? testSet[i].second.toString() : "");
+    }
+    indexOK = indexOK && statistic(db, "hash index stale entries") > 0;
+    delete db;
+
+    std::cout << "HASH INDEX TEST: " << indexOK << std::endl;
+    return indexOK;
+}
+
+
+// the filter answers most lookups of the missing keys by itself, forgets the removed keys, and after a reopen it
+// is rebuilt from the tree without losing any of the present ones
+bool testKeyFilter(std::vector<std::pair<data_blob, data_blob>> &testSet, database_config dbConfig)
+{
+    dbConfig.keyFilterSizeBytes = 16 * 1024;
+
+    database *db = database::createEmpty("test_filter_db", dbConfig);
+    for (size_t i = 0; i < testSet.size(); i += 2) {
+        db->insert(testSet[i].first, testSet[i].second);
+    }
+    for (size_t i = 0; i < testSet.size(); i += 4) {
+        db->remove(testSet[i].first);
+    }
+
+    bool filterOK = true;
+    for (size_t i = 0; i < testSet.size() && filterOK; ++i) {
+        filterOK = lookup(db, testSet[i].first) == (i % 4 == 2 ? testSet[i].second.toString() : "");
+    }
+    filterOK = filterOK && statistic(db, "key filter filtered lookups") > testSet.size() / 2;
+    delete db;
+
+    db = database::openExisting("test_filter_db", dbConfig);
+    filterOK = filterOK && statistic(db, "key filter keys") == testSet.size() / 4;
+    for (size_t i = 2; i < testSet.size() && filterOK; i += 4) {
+        filterOK = lookup(db, testSet[i].first) == testSet[i].second.toString();
+    }
+    delete db;
+
+    std::cout << "KEY FILTER TEST: " << filterOK << std::endl;
+    return filterOK;
+}
+
+
+// the repeated lookups of a few keys are served from the record cache, which never returns a value that has been
+// updated or removed since it was admitted
+bool testRecordCache(std::vector<std::pair<data_blob, data_blob>> &testSet, database_config dbConfig)
+{
+    const size_t hotKeys = 50;
+    dbConfig.recordCacheSizeBytes = 2 * hotKeys * dbConfig.maxDataEntryLength;
+
+    database *db = createFilled("test_records_db", testSet, dbConfig);
+    for (int pass = 0; pass < 2; ++pass) {
+        for (size_t i = 0; i < hotKeys; ++i) lookup(db, testSet[i].first);
+    }
+    bool cacheOK = statistic(db, "record cache hits") >= hotKeys;
+
+    std::string updatedValue = testSet[0].second.toString();
+    updatedValue[0] = 'V';    // in place updates keep the length
+    db->insert(testSet[0].first, data_blob::fromCopyOf(updatedValue));
+    db->remove(testSet[1].first);
+    cacheOK = cacheOK && lookup(db, testSet[0].first) == updatedValue && lookup(db, testSet[1].first).empty();
+
+    for (size_t i = 2; i < testSet.size() && cacheOK; ++i) {
+        cacheOK = lookup(db, testSet[i].first) == testSet[i].second.toString();
+    }
+    cacheOK = cacheOK && statistic(db, "record cache evictions") > 0;
+    delete db;
+
+    std::cout << "RECORD CACHE TEST: " << cacheOK << std::endl;
+    return cacheOK;
+}
+
+
+// a page referenced since the clock hand last passed it gets a second chance, so the path of a key looked up between
+// every two cold lookups is nearly always cached, though the cache is much smaller than the tree (it is lost only
+// when the hand finds all the pages referenced)
+bool testClockPolicy(std::vector<std::pair<data_blob, data_blob>> &testSet, database_config dbConfig)
+{
+    dbConfig.cacheReplacementPolicy = pages_replacement_policy::clock;
+    dbConfig.cacheSizePages = 16;
+    dbConfig.cacheShards = 1;
+
+    database *db = createFilled("test_clock_db", testSet, dbConfig);
+    lookup(db, testSet[0].first);
+
+    bool clockOK = true;
+    size_t hotMisses = 0;
+    for (size_t i = 1; i < testSet.size() && clockOK; ++i) {
+        clockOK = lookup(db, testSet[i].first) == testSet[i].second.toString();
+
+        size_t misses = statistic(db, "misses");
+        clockOK = clockOK && lookup(db, testSet[0].first) == testSet[0].second.toString();
+        hotMisses += statistic(db, "misses") - misses;
+    }
+    clockOK = clockOK && hotMisses < testSet.size() / 100 && statistic(db, "evictions") > 0 && statistic(db, "hits in clock") > 0;
+    delete db;
+
+    std::cout << "CLOCK POLICY TEST: " << clockOK << std::endl;
+    return clockOK;
+}
+
+
+// the misses of a few hot keys looked up twice after every scan that reads each leaf once
+size_t hotMissesAfterScans(std::vector<std::pair<data_blob, data_blob>> &testSet, database_config dbConfig)
+{
+    const size_t hotKeys = 5, scans = 5, scanStep = 25;
+
+    std::vector<std::string> keys;
+    for (auto &record : testSet) keys.push_back(record.first.toString());
+    std::sort(keys.begin(), keys.end());
+
+    database *db = createFilled("test_scan_db", testSet, dbConfig);
+    size_t hotMisses = 0;
+    for (size_t scan = 0; scan <= scans; ++scan) {
+        size_t misses = statistic(db, "misses");
+        for (int pass = 0; pass < 2; ++pass) {
+            for (size_t i = 0; i < hotKeys; ++i) lookup(db, testSet[i].first);
+        }
+        if (scan > 0) hotMisses += statistic(db, "misses") - misses;
+
+        for (size_t i = 0; i < keys.size(); i += scanStep) lookup(db, data_blob::fromCopyOf(keys[i]));
+    }
+    delete db;
+
+    return hotMisses;
+}
+
+
+// the pages referenced twice are kept over the ones a scan has read once, which with plain LRU push them out
+bool testScanResistance(std::vector<std::pair<data_blob, data_blob>> &testSet, database_config dbConfig)
+{
+    dbConfig.cacheSizePages = 32;
+    dbConfig.cacheShards = 1;
+    size_t lruMisses = hotMissesAfterScans(testSet, dbConfig);
+
+    bool resistanceOK = true;
+    for (pages_replacement_policy policy : { pages_replacement_policy::two_queue, pages_replacement_policy::arc,
+                                             pages_replacement_policy::lru2 }) {
+        dbConfig.cacheReplacementPolicy = policy;
+        size_t policyMisses = hotMissesAfterScans(testSet, dbConfig);
+
+        resistanceOK = resistanceOK && policyMisses < lruMisses;
+    }
+
+    std::cout << "SCAN RESISTANCE TEST: " << resistanceOK << std::endl;
+    return resistanceOK;
+}
+
+
+// the pages read while filling a tree many times larger than the cache all come from the frames mapped for the
+// cache at its creation, with or without huge pages
+bool testFramesPool(std::vector<std::pair<data_blob, data_blob>> &testSet, database_config dbConfig)
+{
+    dbConfig.cacheSizePages = 32;
+
+    bool poolOK = true;
+    for (bool hugePages : { false, true }) {
+        dbConfig.cacheHugePages = hugePages;
+        database *db = createFilled("test_frames_db", testSet, dbConfig);
+        for (size_t i = 0; i < testSet.size() && poolOK; ++i) {
+            poolOK = lookup(db, testSet[i].first) == testSet[i].second.toString();
+        }
+
+        poolOK = poolOK && statistic(db, "evictions") > testSet.size() &&
+                 statistic(db, "cache memory bytes") == dbConfig.cacheSizePages * dbConfig.pageSizeBytes &&
+                 statistic(db, "overflow frames") == 0;
+        delete db;
+    }
+
+    std::cout << "FRAMES POOL TEST: " << poolOK << std::endl;
+    return poolOK;
+}
+
+
+// the page table shards are shared by the operations of several threads, the background writer and the prefetch
+// threads of a concurrent tree walk
+bool testShardedPageTable(std::vector<std::pair<data_blob, data_blob>> &testSet, database_config dbConfig)
+{
+    const size_t threadsCount = 4;
+    dbConfig.cacheShards = 8;
+    dbConfig.backgroundWriterPagesPerSecond = 5000;
+    dbConfig.prefetchThreads = 2;
+
+    database *db = database::createEmpty("test_shards_db", dbConfig);
+    std::vector<char> found(testSet.size(), 0);
+
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < threadsCount; ++t) {
+        threads.emplace_back([&, t]() {
+            for (size_t i = t; i < testSet.size(); i += threadsCount) {
+                db->insert(testSet[i].first, testSet[i].second);
+            }
+            for (size_t i = t; i < testSet.size(); i += threadsCount) {
+                found[i] = lookup(db, testSet[i].first) == testSet[i].second.toString();
+            }
+        });
+    }
+    std::string walkedKeys;
+    for (int walk = 0; walk < 3; ++walk) walkedKeys = db->dumpSortedKeys();
+    for (auto &thread : threads) thread.join();
+
+    bool shardsOK = statistic(db, "cache shards") == dbConfig.cacheShards &&
+                    std::count(found.begin(), found.end(), 1) == (long) testSet.size();
+    delete db;
+
+    std::cout << "SHARDED PAGE TABLE TEST: " << shardsOK << std::endl;
+    return shardsOK;
+}
+
+
+// the evictions that had to write a dirty page while the tree was filled in short bursts
+size_t dirtyEvictions(std::vector<std::pair<data_blob, data_blob>> &testSet, const database_config &dbConfig,
+                      size_t &backgroundWrites)
+{
+    database *db = database::createEmpty("test_writer_db", dbConfig);
+    for (size_t i = 0; i < testSet.size(); ++i) {
+        db->insert(testSet[i].first, testSet[i].second);
+        if (i % 50 == 0) std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+
+    size_t evictions = statistic(db, "dirty evictions");
+    backgroundWrites = statistic(db, "background writes");
+    delete db;
+
+    return evictions;
+}
+
+
+// between the bursts of inserts the background writer cleans the pages next to be evicted, so that fewer of them are
+// written by the evictions themselves
+bool testBackgroundWriter(std::vector<std::pair<data_blob, data_blob>> &testSet, database_config dbConfig)
+{
+    dbConfig.cacheSizePages = 32;
+
+    size_t backgroundWrites = 0;
+    size_t plainEvictions = dirtyEvictions(testSet, dbConfig, backgroundWrites);
+    dbConfig.backgroundWriterPagesPerSecond = 20000;
+    size_t writerEvictions = dirtyEvictions(testSet, dbConfig, backgroundWrites);
+
+    bool writerOK = backgroundWrites > 0 && writerEvictions < plainEvictions;
+    database *db = database::openExisting("test_writer_db", dbConfig);
+    for (size_t i = 0; i < testSet.size() && writerOK; ++i) {
+        writerOK = lookup(db, testSet[i].first) == testSet[i].second.toString();
+    }
+    delete db;
+
+    std::cout << "BACKGROUND WRITER TEST: " << writerOK << std::endl;
+    return writerOK;
+}
+
+
+// a whole tree walk over a cold cache has the children of each page read ahead by the prefetch threads and finds
+// them there, with the same result as without them
+bool testPrefetch(std::vector<std::pair<data_blob, data_blob>> &testSet, database_config dbConfig)
+{
+    delete createFilled("test_prefetch_db", testSet, dbConfig);
+
+    database *db = database::openExisting("test_prefetch_db", dbConfig);
+    std::string plainWalk = db->dumpSortedKeys();
+    delete db;
+
+    dbConfig.prefetchThreads = 2;
+    db = database::openExisting("test_prefetch_db", dbConfig);
+    bool prefetchOK = db->dumpSortedKeys() == plainWalk &&
+                      statistic(db, "prefetch reads") > 0 && statistic(db, "prefetch hits") > 0;
+    delete db;
+
+    std::cout << "PREFETCH TEST: " << prefetchOK << std::endl;
+    return prefetchOK;
+}
+
+
+// a working cache shrinks to the new size at once, giving its memory back, and grows by admitting more pages
+bool testCacheResize(std::vector<std::pair<data_blob, data_blob>> &testSet, database_config dbConfig)
+{
+    database *db = createFilled("test_resize_db", testSet, dbConfig);
+
+    bool resizeOK = true;
+    for (size_t sizePages : { (size_t) 16, (size_t) 512 }) {
+        db->setCacheSize(sizePages * dbConfig.pageSizeBytes);
+        bool shrunk = statistic(db, "cached pages") <= sizePages &&
+                      statistic(db, "cache memory bytes") <= sizePages * dbConfig.pageSizeBytes;
+
+        for (size_t i = 0; i < testSet.size() && resizeOK; ++i) {
+            resizeOK = lookup(db, testSet[i].first) == testSet[i].second.toString();
+        }
+        bool grown = statistic(db, "cached pages") > dbConfig.cacheSizePages;
+        resizeOK = resizeOK && statistic(db, "cache size pages") == sizePages &&
+                   (sizePages < dbConfig.cacheSizePages ? shrunk : grown);
+    }
+    delete db;
+
+    std::cout << "CACHE RESIZE TEST: " << resizeOK << std::endl;
+    return resizeOK;
+}
+
+
+// the top internal levels stay cached however many leaves pass through the rest of the cache, and are chosen again
+// as the tree is truncated and grows back
+bool testResidentLevels(std::vector<std::pair<data_blob, data_blob>> &testSet, database_config dbConfig)
+{
+    dbConfig.cacheSizePages = 64;
+    dbConfig.residentTreeLevels = 2;
+
+    database *db = createFilled("test_resident_db", testSet, dbConfig);
+    size_t residentPages = statistic(db, "resident pages");
+
+    bool residentOK = true;
+    for (size_t i = 0; i < testSet.size() && residentOK; ++i) {
+        residentOK = lookup(db, testSet[i].first) == testSet[i].second.toString();
+    }
+    residentOK = residentOK && residentPages > 1 && statistic(db, "resident pages") == residentPages &&
+                 statistic(db, "resident hits") >= 2 * testSet.size();
+
+    // a tree of a single leaf has no internal levels
+    db->truncate();
+    residentOK = residentOK && statistic(db, "resident pages") == 0;
+    for (size_t i = 0; i < testSet.size(); ++i) {
+        db->insert(testSet[i].first, testSet[i].second);
+    }
+    residentOK = residentOK && statistic(db, "resident pages") == residentPages;
+    delete db;
+
+    std::cout << "RESIDENT LEVELS TEST: " << residentOK << std::endl;
+    return residentOK;
+}
+
+
+// the lookups follow the links from the cached parents to the cached children, the links don't keep the children
+// from being evicted in a small cache, and a child that has been evicted, merged or freed is never reached by them
+bool testSwizzling(std::vector<std::pair<data_blob, data_blob>> &testSet, database_config dbConfig)
+{
+    dbConfig.cacheSizePages = 24;
+    dbConfig.swizzleChildPointers = true;
+
+    database *db = createFilled("test_swizzle_db", testSet, dbConfig);
+    bool swizzleOK = true;
+    for (int pass = 0; pass < 2; ++pass) {
+        for (size_t i = 0; i < testSet.size() && swizzleOK; ++i) {
+            swizzleOK = lookup(db, testSet[i].first) == testSet[i].second.toString();
+        }
+    }
+    for (size_t i = 0; i < testSet.size(); ++i) {
+        if (i % 3 != 0) db->remove(testSet[i].first);
+    }
+    for (size_t i = 0; i < testSet.size() && swizzleOK; ++i) {
+        swizzleOK = lookup(db, testSet[i].first) == (i % 3 == 0 ? testSet[i].second.toString() : "");
+    }
+
+    swizzleOK = swizzleOK && statistic(db, "swizzled hits") > 0 &&
+                statistic(db, "swizzled pages") <= statistic(db, "cached pages") &&
+                statistic(db, "failed evictions") == 0 && statistic(db, "overflow frames") == 0;
+    delete db;
+
+    std::cout << "SWIZZLING TEST: " << swizzleOK << std::endl;
+    return swizzleOK;
+}
+
+
+// the evicted pages kept compressed serve the misses of a cache smaller than the tree, within a budget that follows
+// the cache size
+bool testCompressedTier(std::vector<std::pair<data_blob, data_blob>> &testSet, database_config dbConfig)
+{
+    const size_t tierBytes = 256 * 1024;
+    dbConfig.cacheSizePages = 32;
+    dbConfig.cacheCompressedBytes = tierBytes;
+
+    database *db = createFilled("test_compressed_db", testSet, dbConfig);
+    bool tierOK = true;
+    for (int pass = 0; pass < 2; ++pass) {
+        for (size_t i = 0; i < testSet.size() && tierOK; ++i) {
+            tierOK = lookup(db, testSet[i].first) == testSet[i].second.toString();
+        }
+    }
+    tierOK = tierOK && statistic(db, "compressed hits") > 0 && statistic(db, "compressed bytes") <= tierBytes;
+
+    db->setCacheSize(dbConfig.cacheSizePages / 4 * dbConfig.pageSizeBytes);
+    tierOK = tierOK && statistic(db, "compressed bytes") <= tierBytes / 4;
+    delete db;
+
+    std::cout << "COMPRESSED TIER TEST: " << tierOK << std::endl;
+    return tierOK;
+}
+
+
+// a flush writes all the dirty pages in runs of adjacent ones, by one thread or several
+bool testFlush(std::vector<std::pair<data_blob, data_blob>> &testSet, database_config dbConfig)
+{
+    dbConfig.cacheSizePages = 1024;
+
+    bool flushOK = true;
+    for (size_t flushThreads : { (size_t) 1, (size_t) 4 }) {
+        dbConfig.flushThreads = flushThreads;
+        database *db = createFilled("test_flush_db", testSet, dbConfig);
+
+        db->flush();
+        size_t flushedPages = statistic(db, "flushed pages");
+        flushOK = flushOK && statistic(db, "flushes") == 1 && flushedPages == statistic(db, "cached pages") &&
+                  statistic(db, "flush writes") < flushedPages / 4;
+
+        db->flush();    // nothing is left to write
+        flushOK = flushOK && statistic(db, "flushed pages") == flushedPages;
+        delete db;
+
+        db = database::openExisting("test_flush_db", dbConfig);
+        for (size_t i = 0; i < testSet.size() && flushOK; ++i) {
+            flushOK = lookup(db, testSet[i].first) == testSet[i].second.toString();
+        }
+        delete db;
+    }
+
+    std::cout << "FLUSH TEST: " << flushOK << std::endl;
+    return flushOK;
+}
+
+
+// an operation pinning more pages than a tiny cache holds takes the frames over its size instead of failing; the
+// strict cache is back within its size before the next operation starts, the other one as the next misses evict
+bool testCacheOverflow(std::vector<std::pair<data_blob, data_blob>> &testSet, database_config dbConfig)
+{
+    dbConfig.cacheSizePages = 4;
+    dbConfig.cacheShards = 1;
+
+    std::vector<std::string> keys;
+    for (auto &record : testSet) keys.push_back(record.first.toString());
+    std::sort(keys.begin(), keys.end());
+
+    bool overflowOK = true;
+    for (bool strictSize : { false, true }) {
+        dbConfig.cacheStrictSize = strictSize;
+        database *db = createFilled("test_overflow_db", testSet, dbConfig);
+
+        db->removeRange(data_blob::fromCopyOf(keys[keys.size() / 4]), data_blob::fromCopyOf(keys[keys.size() / 2]));
+        bool overflowed = statistic(db, "cached pages") > dbConfig.cacheSizePages;
+        lookup(db, testSet[0].first);
+        overflowOK = overflowOK && overflowed && statistic(db, "overflow frames") > 0 &&
+                     (!strictSize || statistic(db, "cached pages") <= dbConfig.cacheSizePages);
+
+        for (size_t i = 0; i < testSet.size() && overflowOK; ++i) {
+            std::string key = testSet[i].first.toString();
+            bool removed = key >= keys[keys.size() / 4] && key <= keys[keys.size() / 2];
+            overflowOK = lookup(db, testSet[i].first) == (removed ? "" : testSet[i].second.toString());
+        }
+        overflowOK = overflowOK && statistic(db, "cached pages") <= dbConfig.cacheSizePages;
+        delete db;
+    }
+
+    std::cout << "CACHE OVERFLOW TEST: " << overflowOK << std::endl;
+    return overflowOK;
+}
+
+
+// random inserts and erases over a narrow range of ids keep the table equal to an unordered_map, through the growth
+// of the table and the backward shifts of the erased slots
+bool testPageTable()
+{
+    std::mt19937 random(5);
+    page_table table;
+    std::unordered_map<int, db_page *> expected;
+
+    bool tableOK = true;
+    for (int step = 0; step < 200000 && tableOK; ++step) {
+        int pageId = (int) (random() % (step < 100000 ? 4096 : 64));
+        db_page *page = reinterpret_cast<db_page *>((uintptr_t) (pageId + 1) * 64);
+
+        if (random() % 3 != 0) {
+            tableOK = table.insert(pageId, page) == expected.emplace(pageId, page).second;
+        } else {
+            tableOK = table.erase(pageId) == (expected.erase(pageId) == 1);
+        }
+        tableOK = tableOK && table.find(pageId) == (expected.count(pageId) ? expected[pageId] : nullptr) &&
+                  table.size() == expected.size();
+    }
+
+    size_t iterated = 0;
+    for (auto &entry : table) {
+        tableOK = tableOK && expected.count(entry.pageId) && expected[entry.pageId] == entry.page;
+        ++iterated;
+    }
+    tableOK = tableOK && iterated == expected.size();
+
+    std::cout << "PAGE TABLE TEST: " << tableOK << std::endl;
+    return tableOK;
+}
+
+
+// the checkpoints taken while the log grows write the dirty pages in the background, and a crash right after them
+// loses nothing
+bool testFuzzyCheckpoints(std::vector<std::pair<data_blob, data_blob>> &testSet, database_config dbConfig)
+{
+    dbConfig.checkpointLogBytes = 64 * 1024;
+    dbConfig.logDurability = log_durability::per_commit;
+
+    pid_t pid = ::fork();
+    if (pid == 0) {
+        database *db = createFilled("test_checkpoint_db", testSet, dbConfig);
+        bool checkpointed = statistic(db, "checkpoints") > 1 && statistic(db, "checkpoint writes") > 0;
+        ::_exit(checkpointed ? 0 : 1);    // neither the pages nor the log are closed
+    }
+
+    int status = 0;
+    ::waitpid(pid, &status, 0);
+
+    database *db = database::openExisting("test_checkpoint_db", dbConfig);
+    bool checkpointOK = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    for (size_t i = 0; i < testSet.size() && checkpointOK; ++i) {
+        checkpointOK = lookup(db, testSet[i].first) == testSet[i].second.toString();
+    }
+    delete db;
+
+    std::cout << "FUZZY CHECKPOINTS TEST: " << checkpointOK << std::endl;
+    return checkpointOK;
+}
+
+
+size_t logSegmentsCount(const std::string &path)
+{
+    size_t segments = 0;
+    DIR *dir = ::opendir(path.c_str());
+    while (dirent *file = ::readdir(dir)) {
+        std::string name = file->d_name;
+        if (name.compare(0, 4, "log.") == 0 && name.size() > 5 && name.compare(name.size() - 5, 5, ".sdbl") == 0) {
+            segments++;
+        }
+    }
+    ::closedir(dir);
+
+    return segments;
+}
+
+
+// the log written while filling the tree spans many segments, but the ones older than a checkpoint are removed, so
+// only a few of them are on the disk at any time
+bool testLogSegments(std::vector<std::pair<data_blob, data_blob>> &testSet, database_config dbConfig)
+{
+    const size_t segmentBytes = 64 * 1024;
+    dbConfig.logSegmentBytes = segmentBytes;
+    dbConfig.checkpointLogBytes = segmentBytes;
+
+    database *db = database::createEmpty("test_segments_db", dbConfig);
+    size_t maxSegments = 0;
+    for (size_t i = 0; i < testSet.size(); ++i) {
+        db->insert(testSet[i].first, testSet[i].second);
+        maxSegments = std::max(maxSegments, logSegmentsCount("test_segments_db"));
+    }
+    bool segmentsOK = maxSegments <= 10 && statistic(db, "checkpoints") > 5 * maxSegments;
+    delete db;
+
+    db = database::openExisting("test_segments_db", dbConfig);
+    for (size_t i = 0; i < testSet.size() && segmentsOK; ++i) {
+        segmentsOK = lookup(db, testSet[i].first) == testSet[i].second.toString();
+    }
+    delete db;
+
+    std::cout << "LOG SEGMENTS TEST: " << segmentsOK << std::endl;
+    return segmentsOK;
+}
+
+
+// the records are gathered in the log buffer and written in a few large writes, also when a record is larger than
+// the buffer itself
+bool testLogBuffer(std::vector<std::pair<data_blob, data_blob>> &testSet, database_config dbConfig)
+{
+    dbConfig.logDurability = log_durability::async;
+
+    bool bufferOK = true;
+    for (size_t bufferBytes : { (size_t) 256 << 10, (size_t) 512 }) {
+        dbConfig.logBufferBytes = bufferBytes;
+        database *db = createFilled("test_buffer_db", testSet, dbConfig);
+        bool gathered = bufferBytes < dbConfig.pageSizeBytes || statistic(db, "log writes") < testSet.size() / 20;
+        delete db;
+
+        db = database::openExisting("test_buffer_db", dbConfig);
+        bufferOK = bufferOK && gathered;
+        for (size_t i = 0; i < testSet.size() && bufferOK; ++i) {
+            bufferOK = lookup(db, testSet[i].first) == testSet[i].second.toString();
+        }
+        delete db;
+    }
+
+    std::cout << "LOG BUFFER TEST: " << bufferOK << std::endl;
+    return bufferOK;
+}
+
+
 int main (int argc, char** argv)
 {
     database_config dbConfig;
@@ -60,6 +945,34 @@ int main (int argc, char** argv)
     std::vector<std::pair<data_blob, data_blob>> testSet;
     fillTestSet(testSet, 5000);
 
+    bool featuresOK = testRangeRemoval(testSet, dbConfig) &&
+                      testDeferredRebalancing(testSet, dbConfig) &&
+                      testHashIndex(testSet, dbConfig) &&
+                      testKeyFilter(testSet, dbConfig) &&
+                      testRecordCache(testSet, dbConfig) &&
+                      testClockPolicy(testSet, dbConfig) &&
+                      testScanResistance(testSet, dbConfig) &&
+                      testFramesPool(testSet, dbConfig) &&
+                      testShardedPageTable(testSet, dbConfig) &&
+                      testBackgroundWriter(testSet, dbConfig) &&
+                      testPrefetch(testSet, dbConfig) &&
+                      testCacheResize(testSet, dbConfig) &&
+                      testCachePreload(testSet, dbConfig) &&
+                      testResidentLevels(testSet, dbConfig) &&
+                      testSwizzling(testSet, dbConfig) &&
+                      testCompressedTier(testSet, dbConfig) &&
+                      testFlush(testSet, dbConfig) &&
+                      testCacheOverflow(testSet, dbConfig) &&
+                      testPageTable() &&
+                      testFuzzyCheckpoints(testSet, dbConfig) &&
+                      testLogSegments(testSet, dbConfig) &&
+                      testLogBuffer(testSet, dbConfig) &&
+                      testCrashRecovery(testSet, dbConfig) &&
+                      testGroupCommit(testSet, dbConfig);
+    if (!featuresOK) {
+        return 1;
+    }
+
     if (database::exists("test_db")) {
         //testOpening(testSet);
         //return 0;